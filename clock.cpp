@@ -0,0 +1,97 @@
+/**
+ * \file clock.cpp
+ * \brief Coarse clock shared by all threads
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <thread>
+#include <unistd.h>
+
+#include <ipfixprobe/clock.hpp>
+
+namespace ipxp {
+
+CoarseClock::State CoarseClock::s_state;
+
+static std::atomic<bool> s_running(false);
+static std::thread *s_ticker = nullptr;
+
+void CoarseClock::update()
+{
+   struct timeval tv;
+   struct timespec ts;
+   gettimeofday(&tv, nullptr);
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   s_state.m_wall.store(static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec, std::memory_order_relaxed);
+   s_state.m_monotonic.store(static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec, std::memory_order_relaxed);
+}
+
+void CoarseClock::ticker(uint32_t tick)
+{
+   while (s_running.load(std::memory_order_relaxed)) {
+      usleep(tick);
+      update();
+   }
+}
+
+void CoarseClock::start(uint32_t tick)
+{
+   if (s_ticker != nullptr) {
+      return;
+   }
+   // Values are valid before the first tick
+   update();
+   s_running = true;
+   s_ticker = new std::thread(ticker, tick);
+}
+
+void CoarseClock::stop()
+{
+   if (s_ticker == nullptr) {
+      return;
+   }
+   s_running = false;
+   s_ticker->join();
+   delete s_ticker;
+   s_ticker = nullptr;
+   s_state.m_wall.store(0, std::memory_order_relaxed);
+   s_state.m_monotonic.store(0, std::memory_order_relaxed);
+}
+
+}
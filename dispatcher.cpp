@@ -0,0 +1,369 @@
+/**
+ * \file dispatcher.cpp
+ * \brief Dispatching of packets from inputs to flow cache shards by flow hash
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#include "dispatcher.hpp"
+#include "ipfixprobe.hpp"
+#include "workers.hpp"
+
+namespace ipxp {
+
+DispatchChannel::DispatchChannel(size_t block_size, size_t pkt_bufsize) :
+   m_full(DISPATCH_BLOCKS), m_free(DISPATCH_BLOCKS), m_current(nullptr)
+{
+   for (uint32_t i = 0; i < DISPATCH_BLOCKS; i++) {
+      DispatchBlock *block = new DispatchBlock(block_size, pkt_bufsize, this);
+      m_blocks.push_back(block);
+      m_free.push(block);
+   }
+}
+
+DispatchChannel::~DispatchChannel()
+{
+   for (auto it : m_blocks) {
+      delete it;
+   }
+}
+
+Dispatcher::Dispatcher(size_t inputs, size_t shards, size_t block_size, size_t pkt_bufsize, const IdleConfig &idle) :
+   m_inputs(inputs), m_shards(shards), m_block_size(block_size), m_pkt_bufsize(pkt_bufsize), m_next_input(shards, 0),
+   m_inputs_done(0), m_stop(false)
+{
+   for (size_t i = 0; i < inputs * shards; i++) {
+      m_channels.push_back(new DispatchChannel(block_size, pkt_bufsize));
+   }
+   for (size_t i = 0; i < inputs; i++) {
+      m_backoff.push_back(new IdleBackoff(idle, -1));
+   }
+}
+
+Dispatcher::~Dispatcher()
+{
+   for (auto it : m_channels) {
+      delete it;
+   }
+   for (auto it : m_backoff) {
+      delete it;
+   }
+}
+
+/**
+ * \brief Get flow hash which is the same for both directions of a flow.
+ */
+static uint64_t symmetric_hash(const Packet &pkt)
+{
+   uint64_t src;
+   uint64_t dst;
+   if (pkt.ip_version == IP::v4) {
+      src = (static_cast<uint64_t>(pkt.src_ip.v4) << 16) | pkt.src_port;
+      dst = (static_cast<uint64_t>(pkt.dst_ip.v4) << 16) | pkt.dst_port;
+   } else if (pkt.ip_version == IP::v6) {
+      uint64_t tmp[4];
+      memcpy(tmp, pkt.src_ip.v6, 16);
+      memcpy(tmp + 2, pkt.dst_ip.v6, 16);
+      src = ((tmp[0] ^ tmp[1]) * 0x9E3779B97F4A7C15ULL) ^ pkt.src_port;
+      dst = ((tmp[2] ^ tmp[3]) * 0x9E3779B97F4A7C15ULL) ^ pkt.dst_port;
+   } else {
+      return 0;
+   }
+   if (src > dst) {
+      std::swap(src, dst);
+   }
+
+   uint64_t hash = (src * 0x9E3779B97F4A7C15ULL) ^ (dst * 0xC2B2AE3D27D4EB4FULL) ^ pkt.ip_proto;
+   hash ^= hash >> 29;
+   hash *= 0xBF58476D1CE4E5B9ULL;
+   hash ^= hash >> 32;
+   return hash;
+}
+
+/**
+ * \brief Get shard owning flow of the packet.
+ */
+size_t Dispatcher::get_shard(const Packet &pkt, size_t shards)
+{
+   return ((symmetric_hash(pkt) >> 32) * shards) >> 32;
+}
+
+/**
+ * \brief Wait for a free block of the channel. Input waits for a shard which is behind
+ * with the same thresholds as idle workers.
+ * \param [in] input Index of input calling the function.
+ * \return False when the program is terminating.
+ */
+bool Dispatcher::acquire(size_t input, DispatchChannel &channel)
+{
+   IdleBackoff &backoff = *m_backoff[input];
+   if (channel.m_free.pop(channel.m_current)) {
+      return true;
+   }
+   do {
+      if (terminate_input || is_stopped()) {
+         channel.m_current = nullptr;
+         return false;
+      }
+      backoff.idle();
+   } while (!channel.m_free.pop(channel.m_current));
+   backoff.busy();
+   return true;
+}
+
+/**
+ * \brief Get number of polls the input spent waiting for free blocks.
+ * \param [in] input Index of input.
+ */
+uint64_t Dispatcher::get_waits(size_t input) const
+{
+   return m_backoff[input]->m_idle;
+}
+
+/**
+ * \brief Copy packet data into buffer of a dispatch block and point the packet to it.
+ * \param [in,out] pkt Packet pointing into buffers of the input.
+ * \param [in] data Buffer of the packet in the block.
+ * \param [in] bufsize Size of the buffer.
+ */
+static void localize_packet(Packet &pkt, uint8_t *data, size_t bufsize)
+{
+   const uint8_t *packet = pkt.packet;
+   const uint8_t *payload = pkt.payload;
+   pkt.m_exts = nullptr;
+   pkt.buffer = data;
+   pkt.buffer_size = bufsize;
+   if (packet != nullptr) {
+      uint16_t len = std::min<size_t>(pkt.packet_len, bufsize);
+      if (packet != data) {
+         memmove(data, packet, len);
+      }
+      if (payload >= packet && payload <= packet + pkt.packet_len) {
+         uint16_t offset = std::min<size_t>(payload - packet, len);
+         pkt.payload = data + offset;
+         pkt.payload_len = std::min<uint16_t>(pkt.payload_len, len - offset);
+      } else {
+         pkt.payload = nullptr;
+         pkt.payload_len = 0;
+      }
+      pkt.packet = data;
+      pkt.packet_len = len;
+   } else {
+      pkt.payload = nullptr;
+      pkt.payload_len = 0;
+   }
+   pkt.custom = nullptr;
+   pkt.custom_len = 0;
+}
+
+/**
+ * \brief Copy packet to block of its shard. Full blocks are passed to the shard.
+ * \param [in] input Index of input calling the function.
+ * \param [in] pkt Packet pointing into buffers of the input.
+ * \return False when packet was dropped because the program is terminating.
+ */
+bool Dispatcher::put(size_t input, const Packet &pkt)
+{
+   size_t shard = m_shards == 1 ? 0 : get_shard(pkt, m_shards);
+   DispatchChannel &channel = *m_channels[input * m_shards + shard];
+   if (channel.m_current == nullptr && !acquire(input, channel)) {
+      return false;
+   }
+
+   PacketBlock &block = channel.m_current->m_block;
+   Packet &dst = block.pkts[block.cnt];
+   dst = pkt;
+   localize_packet(dst, channel.m_current->m_data + block.cnt * m_pkt_bufsize, m_pkt_bufsize);
+
+   block.cnt++;
+   block.bytes += pkt.packet_len_wire;
+   if (block.cnt == block.size) {
+      channel.m_full.push(channel.m_current);
+      channel.m_current = nullptr;
+   }
+   return true;
+}
+
+/**
+ * \brief Pass partially filled blocks of the input to shards.
+ */
+void Dispatcher::flush(size_t input)
+{
+   for (size_t i = 0; i < m_shards; i++) {
+      DispatchChannel &channel = *m_channels[input * m_shards + i];
+      if (channel.m_current != nullptr && channel.m_current->m_block.cnt) {
+         channel.m_full.push(channel.m_current);
+         channel.m_current = nullptr;
+      }
+   }
+}
+
+/**
+ * \brief Get free block of a single shard channel, which the input fills instead of its own block.
+ * Packets are then not copied one by one, only their data is moved into the block by push_direct.
+ * \param [in] input Index of input calling the function.
+ * \return Empty block or nullptr when packets must be put one by one or the program is terminating.
+ */
+PacketBlock *Dispatcher::direct_block(size_t input)
+{
+   if (m_shards != 1) {
+      return nullptr;
+   }
+   DispatchChannel &channel = *m_channels[input];
+   if (channel.m_current == nullptr && !acquire(input, channel)) {
+      return nullptr;
+   }
+   PacketBlock &block = channel.m_current->m_block;
+   block.cnt = 0;
+   block.bytes = 0;
+   block.size = m_block_size;
+   return &block;
+}
+
+/**
+ * \brief Pass block filled by the input to the shard. Packet data still owned by the input is copied into the block.
+ */
+void Dispatcher::push_direct(size_t input)
+{
+   DispatchChannel &channel = *m_channels[input];
+   DispatchBlock *current = channel.m_current;
+   PacketBlock &block = current->m_block;
+   for (size_t i = 0; i < block.cnt; i++) {
+      localize_packet(block.pkts[i], current->m_data + i * m_pkt_bufsize, m_pkt_bufsize);
+   }
+   channel.m_full.push(current);
+   channel.m_current = nullptr;
+}
+
+/**
+ * \brief Mark one input as finished. Shards exit when all inputs are finished and their blocks processed.
+ */
+void Dispatcher::input_done()
+{
+   m_inputs_done++;
+}
+
+bool Dispatcher::inputs_done() const
+{
+   return m_inputs_done.load() == m_inputs;
+}
+
+/**
+ * \brief Get next full block for shard, inputs are visited in round robin order.
+ * \return Block or nullptr when no block is available.
+ */
+DispatchBlock *Dispatcher::pop(size_t shard)
+{
+   DispatchBlock *block;
+   size_t input = m_next_input[shard];
+   for (size_t i = 0; i < m_inputs; i++) {
+      if (m_channels[input * m_shards + shard]->m_full.pop(block)) {
+         m_next_input[shard] = (input + 1) % m_inputs;
+         return block;
+      }
+      input = (input + 1) % m_inputs;
+   }
+   return nullptr;
+}
+
+/**
+ * \brief Return processed block to its input.
+ */
+void Dispatcher::release(DispatchBlock *block)
+{
+   block->m_block.cnt = 0;
+   block->m_block.bytes = 0;
+   block->m_channel->m_free.push(block);
+}
+
+/**
+ * \brief Stop shards without waiting for inputs.
+ */
+void Dispatcher::stop()
+{
+   m_stop = true;
+}
+
+bool Dispatcher::is_stopped() const
+{
+   return m_stop.load();
+}
+
+int DispatchStorage::put_pkt(Packet &pkt)
+{
+   m_dispatcher->put(m_input, pkt);
+   return 0;
+}
+
+int DispatchStorage::put_pkts(PacketBlock &block)
+{
+   if (&block == m_direct) {
+      m_direct = nullptr;
+      if (block.cnt) {
+         m_dispatcher->push_direct(m_input);
+      }
+      return 0;
+   }
+   for (size_t i = 0; i < block.cnt; i++) {
+      m_dispatcher->put(m_input, block.pkts[i]);
+   }
+   m_dispatcher->flush(m_input);
+   return 0;
+}
+
+PacketBlock *DispatchStorage::get_block()
+{
+   m_direct = m_dispatcher->direct_block(m_input);
+   return m_direct;
+}
+
+void DispatchStorage::finish()
+{
+   if (m_direct != nullptr) {
+      // Packets of a block which was not put point into buffers of the input
+      m_direct->cnt = 0;
+      m_direct = nullptr;
+   }
+   m_dispatcher->flush(m_input);
+   m_dispatcher->input_done();
+}
+
+}
@@ -0,0 +1,167 @@
+/**
+ * \file dispatcher.hpp
+ * \brief Dispatching of packets from inputs to flow cache shards by flow hash
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef IPXP_DISPATCHER_HPP
+#define IPXP_DISPATCHER_HPP
+
+#include <atomic>
+#include <vector>
+#include <string>
+
+#include <ipfixprobe/storage.hpp>
+#include <ipfixprobe/packet.hpp>
+#include <ipfixprobe/spscring.hpp>
+
+namespace ipxp {
+
+static const uint32_t DISPATCH_BLOCKS = 8; /**< Number of packet blocks owned by each input-shard channel. */
+
+struct DispatchChannel;
+struct IdleConfig;
+class IdleBackoff;
+
+/**
+ * \brief Block of packets copied from input buffers, owned by one input-shard channel.
+ */
+struct DispatchBlock {
+   PacketBlock m_block;
+   uint8_t *m_data;
+   DispatchChannel *m_channel;
+
+   DispatchBlock(size_t size, size_t pkt_bufsize, DispatchChannel *channel) :
+      m_block(size), m_data(new uint8_t[size * pkt_bufsize]), m_channel(channel)
+   {
+   }
+   ~DispatchBlock()
+   {
+      delete [] m_data;
+   }
+};
+
+/**
+ * \brief Channel from one input to one shard. Full blocks go to the shard, processed blocks return back.
+ */
+struct DispatchChannel {
+   SPSCRing<DispatchBlock *> m_full;
+   SPSCRing<DispatchBlock *> m_free;
+   DispatchBlock *m_current; /**< Block being filled by input. */
+   std::vector<DispatchBlock *> m_blocks;
+
+   DispatchChannel(size_t block_size, size_t pkt_bufsize);
+   ~DispatchChannel();
+};
+
+/**
+ * \brief Distributes packets of all inputs to flow cache shards, so that both directions
+ * of a flow always reach the same shard.
+ */
+class Dispatcher
+{
+public:
+   Dispatcher(size_t inputs, size_t shards, size_t block_size, size_t pkt_bufsize, const IdleConfig &idle);
+   ~Dispatcher();
+
+   size_t get_shards() const
+   {
+      return m_shards;
+   }
+
+   static size_t get_shard(const Packet &pkt, size_t shards);
+
+   bool put(size_t input, const Packet &pkt);
+   void flush(size_t input);
+   PacketBlock *direct_block(size_t input);
+   void push_direct(size_t input);
+   void input_done();
+
+   DispatchBlock *pop(size_t shard);
+   void release(DispatchBlock *block);
+   bool inputs_done() const;
+   uint64_t get_waits(size_t input) const;
+
+   void stop();
+   bool is_stopped() const;
+
+private:
+   size_t m_inputs;
+   size_t m_shards;
+   size_t m_block_size;
+   size_t m_pkt_bufsize;
+   std::vector<DispatchChannel *> m_channels; /**< Channels indexed by input * shards + shard. */
+   std::vector<size_t> m_next_input; /**< Round robin position of each shard. */
+   std::atomic<size_t> m_inputs_done;
+   std::atomic<bool> m_stop;
+   std::vector<IdleBackoff *> m_backoff; /**< Waiting of each input for free blocks of shards. */
+
+   bool acquire(size_t input, DispatchChannel &channel);
+};
+
+/**
+ * \brief Storage plugin of an input in dispatcher mode. Packets are passed to shard caches.
+ */
+class DispatchStorage : public StoragePlugin
+{
+public:
+   DispatchStorage(Dispatcher *dispatcher, size_t input) : m_dispatcher(dispatcher), m_input(input), m_direct(nullptr)
+   {
+   }
+
+   OptionsParser *get_parser() const { return new OptionsParser("dispatch", "Dispatch packets to flow cache shards"); }
+   std::string get_name() const { return "dispatch"; }
+
+   int put_pkt(Packet &pkt);
+   int put_pkts(PacketBlock &block);
+   PacketBlock *get_block();
+   uint64_t get_waits() const
+   {
+      return m_dispatcher->get_waits(m_input);
+   }
+   void finish();
+
+private:
+   Dispatcher *m_dispatcher;
+   size_t m_input;
+   PacketBlock *m_direct; /**< Block of the channel handed to the input by get_block. */
+};
+
+}
+#endif /* IPXP_DISPATCHER_HPP */
@@ -0,0 +1,131 @@
+/**
+ * \file clock.hpp
+ * \brief Coarse clock shared by all threads
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef IPXP_CLOCK_HPP
+#define IPXP_CLOCK_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <sys/time.h>
+
+namespace ipxp {
+
+#define CLOCK_TICK 1000 ///< Default period of the clock ticker in microseconds.
+
+/**
+ * \brief Coarse wall and monotonic clock shared by all threads.
+ *
+ * A ticker thread reads the system clocks once per tick and stores the values into a single
+ * cache line, readers only load them. All threads therefore see the same time and reading it
+ * costs no system or vDSO call. Until the ticker is started, the system clocks are read directly.
+ */
+class CoarseClock
+{
+public:
+   /**
+    * \brief Start the ticker thread.
+    * \param [in] tick Period of updates in microseconds.
+    * \throw std::system_error when the thread cannot be started.
+    */
+   static void start(uint32_t tick = CLOCK_TICK);
+
+   /**
+    * \brief Stop the ticker thread, the system clocks are read directly again.
+    */
+   static void stop();
+
+   /**
+    * \brief Get wall clock time.
+    */
+   static struct timeval now()
+   {
+      int64_t usec = s_state.m_wall.load(std::memory_order_relaxed);
+      if (usec == 0) {
+         struct timeval tv;
+         gettimeofday(&tv, nullptr);
+         return tv;
+      }
+      struct timeval tv = {static_cast<time_t>(usec / 1000000), static_cast<suseconds_t>(usec % 1000000)};
+      return tv;
+   }
+
+   /**
+    * \brief Get wall clock time in seconds.
+    */
+   static time_t seconds()
+   {
+      return now().tv_sec;
+   }
+
+   /**
+    * \brief Get monotonic time.
+    */
+   static struct timespec monotonic()
+   {
+      int64_t nsec = s_state.m_monotonic.load(std::memory_order_relaxed);
+      if (nsec == 0) {
+         struct timespec ts;
+         clock_gettime(CLOCK_MONOTONIC, &ts);
+         return ts;
+      }
+      struct timespec ts = {static_cast<time_t>(nsec / 1000000000), static_cast<long>(nsec % 1000000000)};
+      return ts;
+   }
+
+private:
+   /**
+    * \brief Time published by the ticker, zero when the ticker is not running.
+    */
+   struct alignas(64) State {
+      std::atomic<int64_t> m_wall; /**< Wall time in microseconds. */
+      std::atomic<int64_t> m_monotonic; /**< Monotonic time in nanoseconds. */
+   };
+
+   static State s_state;
+
+   static void update();
+   static void ticker(uint32_t tick);
+};
+
+}
+#endif /* IPXP_CLOCK_HPP */
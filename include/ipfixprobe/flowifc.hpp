@@ -52,6 +52,7 @@
 #include <config.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 #include <sys/time.h>
 
 #ifdef WITH_NEMEA
@@ -63,13 +64,25 @@
 
 #include <arpa/inet.h>
 #include "ipaddr.hpp"
+#include "spscring.hpp"
 
 namespace ipxp {
 
+class StoragePlugin;
+
 #define BASIC_PLUGIN_NAME "basic"
 
+struct RecordExt;
+
+/**
+ * \brief Create empty extension, which is then filled by RecordExt::load.
+ */
+typedef RecordExt *(*RecordExtFactory)();
+
 int register_extension();
+int register_extension(RecordExtFactory factory);
 int get_extension_cnt();
+RecordExt *create_extension(int id);
 
 /**
  * \brief Flow record extension base struct.
@@ -135,6 +148,29 @@ struct RecordExt {
       return "";
    }
 
+   /**
+    * \brief Save extension data, so that the flow can be restored by another run of the flow cache.
+    * Extensions which implement it must be registered with a factory.
+    * \param [out] buffer Buffer for the data.
+    * \param [in] size Size of the buffer.
+    * \return Number of bytes written to buffer or -1 if data cannot be saved.
+    */
+   virtual int save(uint8_t *buffer, size_t size) const
+   {
+      return -1;
+   }
+
+   /**
+    * \brief Restore extension data written by save.
+    * \param [in] buffer Saved data.
+    * \param [in] size Size of the saved data.
+    * \return True when the data was restored.
+    */
+   virtual bool load(const uint8_t *buffer, size_t size)
+   {
+      return false;
+   }
+
    /**
     * \brief Add extension at the end of linked list.
     * \param [in] ext Extension to add.
@@ -281,6 +317,26 @@ struct Flow : public Record {
    uint8_t src_mac[6];
    uint8_t dst_mac[6];
    uint8_t end_reason;
+
+   uint32_t sampling_interval; /**< Flow was selected by deterministic flow sampling as 1 out of sampling_interval flows, 1 when flows are not sampled. */
+   SPSCRing<Flow *> *release_queue; /**< Queue returning the record to its storage after export, nullptr when storage does not recycle records. */
+   StoragePlugin *deferred; /**< Storage whose process plugins deferred pre_export to an analytics worker, nullptr when none. */
+   uint64_t deferred_plugins; /**< Bit N is set when pre_export of N-th process plugin of the storage was deferred. */
+
+   Flow() : sampling_interval(1), release_queue(nullptr), deferred(nullptr), deferred_plugins(0)
+   {
+   }
+
+   /**
+    * \brief Return exported record to the storage. Must be called by the output once the record is not used anymore.
+    */
+   void release()
+   {
+      if (release_queue != nullptr) {
+         // Queue can hold every record of its storage, so there is always room
+         release_queue->push(this);
+      }
+   }
 };
 
 }
@@ -74,6 +74,16 @@ public:
    virtual ~InputPlugin() {}
 
    virtual Result get(PacketBlock &packets) = 0;
+
+   /**
+    * \brief Get descriptor which becomes readable when packets arrive.
+    * Idle worker blocks on the descriptor instead of sleeping.
+    * \return Descriptor or -1 when not available.
+    */
+   virtual int get_fd() const
+   {
+      return -1;
+   }
 };
 
 }
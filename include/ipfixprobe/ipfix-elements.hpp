@@ -95,6 +95,8 @@ namespace ipxp {
 #define INPUT_INTERFACE(F)            F(0,       10,    4,   &this->dir_bit_field)
 #define OUTPUT_INTERFACE(F)           F(0,       14,    2,   nullptr)
 #define FLOW_END_REASON(F)            F(0,      136,    1,   &flow.end_reason)
+#define SAMPLING_INTERVAL(F)          F(0,       34,    4,   &flow.sampling_interval)
+#define SAMPLING_ALGORITHM(F)         F(0,       35,    1,   &this->sampling_algorithm)
 
 #define ETHERTYPE(F)                  F(0,      256,    2,   nullptr)
 
@@ -394,6 +396,11 @@ namespace ipxp {
    F(L2_SRC_MAC) \
    F(L2_DST_MAC)
 
+/* Appended to basic templates of flows kept by flow sampling of the storage. */
+#define IPFIX_SAMPLING_TEMPLATE(F) \
+   F(SAMPLING_INTERVAL) \
+   F(SAMPLING_ALGORITHM)
+
 #define IPFIX_HTTP_TEMPLATE(F) \
    F(HTTP_USERAGENT) \
    F(HTTP_METHOD) \
@@ -653,6 +660,7 @@ namespace ipxp {
 #define IPFIX_ENABLED_TEMPLATES(F) \
    BASIC_TMPLT_V4(F) \
    BASIC_TMPLT_V6(F) \
+   IPFIX_SAMPLING_TEMPLATE(F) \
    IPFIX_HTTP_TEMPLATE(F) \
    IPFIX_RTSP_TEMPLATE(F) \
    IPFIX_TLS_TEMPLATE(F) \
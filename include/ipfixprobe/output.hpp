@@ -62,8 +62,10 @@ public:
    typedef std::vector<std::pair<std::string, ProcessPlugin *>> Plugins;
    uint64_t m_flows_seen; /**< Number of flows received to export. */
    uint64_t m_flows_dropped; /**< Number of flows that could not be exported. */
+   uint32_t m_worker_id; /**< Index of output worker owning this instance, set before init. */
+   uint32_t m_worker_cnt; /**< Number of output workers, set before init. */
 
-   OutputPlugin() : m_flows_seen(0), m_flows_dropped(0) {}
+   OutputPlugin() : m_flows_seen(0), m_flows_dropped(0), m_worker_id(0), m_worker_cnt(1) {}
    virtual ~OutputPlugin() {}
 
    virtual void init(const char *params, Plugins &plugins) = 0;
@@ -55,6 +55,15 @@
 
 namespace ipxp {
 
+/**
+ * \brief Kind of packet hash provided by input (NIC RSS or kernel).
+ */
+enum class RxHash : uint8_t {
+   NONE, /**< Input did not provide a hash. */
+   ASYMMETRIC, /**< Directions of one connection can have different hashes. */
+   SYMMETRIC /**< Both directions of one connection have the same hash. */
+};
+
 /**
  * \brief Structure for storing parsed packet fields
  */
@@ -64,6 +73,9 @@ struct Packet : public Record {
    uint8_t     dst_mac[6];
    uint8_t     src_mac[6];
    uint16_t    ethertype;
+   uint16_t    vlan_id; /**< ID of the outer VLAN tag, 0 when packet is untagged */
+   uint32_t    mpls_label; /**< Top label of MPLS stack, 0 when packet has no MPLS header */
+   uint16_t    link_index; /**< Index of input which received the packet */
 
    uint16_t    ip_len; /**< Length of IP header + its payload */
    uint16_t    ip_payload_len; /**< Length of IP payload */
@@ -101,12 +113,15 @@ struct Packet : public Record {
 
    bool        source_pkt; /**< Direction of packet from flow point of view */
 
+   uint32_t    rx_hash; /**< Hash computed by NIC or kernel, valid when rx_hash_type is not NONE */
+   RxHash      rx_hash_type; /**< Kind of rx_hash */
+
    /**
     * \brief Constructor.
     */
    Packet() :
       ts({0}),
-      dst_mac(), src_mac(), ethertype(0),
+      dst_mac(), src_mac(), ethertype(0), vlan_id(0), mpls_label(0), link_index(0),
       ip_len(0), ip_payload_len(0), ip_version(0), ip_ttl(0),
       ip_proto(0), ip_tos(0), ip_flags(0), src_ip({0}), dst_ip({0}),
       src_port(0), dst_port(0), tcp_flags(0), tcp_window(0),
@@ -115,7 +130,7 @@ struct Packet : public Record {
       payload(nullptr), payload_len(0), payload_len_wire(0),
       custom(nullptr), custom_len(0),
       buffer(nullptr), buffer_size(0),
-      source_pkt(true)
+      source_pkt(true), rx_hash(0), rx_hash_type(RxHash::NONE)
    {
    }
 };
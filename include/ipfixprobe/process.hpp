@@ -132,6 +132,19 @@ public:
    virtual void pre_export(Flow &rec)
    {
    }
+
+   /**
+    * \brief Check whether pre_export of the record is expensive and may be deferred to an analytics worker.
+    * Deferred pre_export is called after pre_export of plugins which were not deferred, from another
+    * thread and concurrently with other calls of the same plugin instance. It may access only the flow
+    * record and configuration which does not change after init.
+    * \param [in] rec Reference to flow record.
+    * \return True when pre_export should be deferred.
+    */
+   virtual bool defer_export(const Flow &rec) const
+   {
+      return false;
+   }
 };
 
 }
@@ -63,6 +63,10 @@ typedef void ipx_msg_t;
  * from one or more produces to a single reader. The ring buffer is supposed to be used as a part
  * of IPFIXcol internal message pipeline.
  *
+ * Writers and the reader are synchronized through sequence numbers of the ring slots, no locks
+ * are used. Writers reserve slots by an atomic operation on the writer head, one per burst.
+ * A reader waiting for messages can be woken up through an event descriptor.
+ *
  * @{
  */
 
@@ -74,9 +78,9 @@ typedef struct ipx_ring ipx_ring_t;
  *
  * \note If \p mw_mode is disabled and multiple writers try to write into the buffer at the same
  *   time, result is undefined!
- * \note Enabling \p mw_mode has significant impact on performance in case the protection is not
+ * \note Enabling \p mw_mode has impact on performance in case the protection is not
  *   necessary.
- * \param[in] size    Size of the ring buffer (number of pointers)
+ * \param[in] size    Size of the ring buffer (number of pointers), rounded up to a power of two
  * \param[in] mw_mode Multi-writer mode (multiple writers can writer into the buffer)
  * \return A pointer to the buffer or NULL (in case of an error).
  */
@@ -103,17 +107,60 @@ ipx_ring_destroy(ipx_ring_t *ring);
 IPX_API void
 ipx_ring_push(ipx_ring_t *ring, ipx_msg_t *msg);
 
+/**
+ * \brief Add messages into the ring buffer
+ *
+ * Same as ipx_ring_push(), but the writer head is updated once for all the messages that fit
+ * into the buffer. Messages of one writer are added in order, but when the buffer does not have
+ * room for all of them, messages of other writers may be added between parts of the burst.
+ * \note The function blocks until all the messages are added.
+ * \param[in] ring Ring buffer
+ * \param[in] msgs Messages to be added into the ring buffer
+ * \param[in] cnt  Number of messages
+ */
+IPX_API void
+ipx_ring_push_burst(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t cnt);
+
 /**
  * \brief Get a message from the ring buffer
  *
- * \note The function blocks until the message is ready.
+ * \note The function waits for a short time (10 ms) when the buffer is empty.
  * \warning Cannot be used concurrently by multiple threads at the same time.
  * \param[in] ring Ring buffer
- * \return Pointer to the message
+ * \return Pointer to the message or NULL when no message arrived in time
  */
 IPX_API ipx_msg_t *
 ipx_ring_pop(ipx_ring_t *ring);
 
+/**
+ * \brief Get up to \p max messages from the ring buffer
+ *
+ * Messages returned by a call are considered processed by the next call, until then they are
+ * included in ipx_ring_cnt().
+ * \note The function waits for a short time (10 ms) when the buffer is empty.
+ * \warning Cannot be used concurrently by multiple threads at the same time.
+ * \param[in]  ring Ring buffer
+ * \param[out] msgs Array for messages
+ * \param[in]  max  Size of the array
+ * \return Number of messages, 0 when no message arrived in time
+ */
+IPX_API uint32_t
+ipx_ring_pop_burst(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t max);
+
+/**
+ * \brief Set how the reader waits for messages when the buffer is empty
+ *
+ * The reader checks the buffer \p spin times, then \p yield times giving up the CPU between
+ * the checks, and then sleeps until a writer wakes it up or the wait times out. By default,
+ * the reader spins 64 times and does not yield.
+ * \warning Must not be called while the reader waits.
+ * \param[in] ring  Ring buffer
+ * \param[in] spin  Number of busy checks
+ * \param[in] yield Number of checks with yielding
+ */
+IPX_API void
+ipx_ring_reader_idle(ipx_ring_t *ring, uint32_t spin, uint32_t yield);
+
 /**
  * \brief Change (i.e. disable/enable) multi-writer mode
  *
@@ -132,6 +179,16 @@ ipx_ring_cnt(const ipx_ring_t *ring);
 IPX_API uint32_t
 ipx_ring_size(const ipx_ring_t *ring);
 
+/**
+ * \brief Get event descriptor used to wake up the reader
+ *
+ * The descriptor becomes readable when a writer adds messages while the reader waits.
+ * \param[in] ring Ring buffer
+ * \return Descriptor or -1 when wakeups are not available and the reader polls
+ */
+IPX_API int
+ipx_ring_fd(const ipx_ring_t *ring);
+
 /**
  * @}
  */
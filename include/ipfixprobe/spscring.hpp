@@ -0,0 +1,115 @@
+/**
+ * \file spscring.hpp
+ * \brief Lock-free ring passing items between two threads
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef IPXP_SPSCRING_HPP
+#define IPXP_SPSCRING_HPP
+
+#include <atomic>
+#include <stdint.h>
+
+namespace ipxp {
+
+/**
+ * \brief Bounded lock-free single producer single consumer ring.
+ */
+template<typename T>
+class SPSCRing
+{
+public:
+   SPSCRing(uint32_t size) : m_items(nullptr), m_mask(0), m_head(0), m_tail(0)
+   {
+      uint32_t cap = 1;
+      while (cap < size) {
+         cap <<= 1;
+      }
+      m_items = new T[cap];
+      m_mask = cap - 1;
+   }
+   ~SPSCRing()
+   {
+      delete [] m_items;
+   }
+   SPSCRing(const SPSCRing &other) = delete;
+   SPSCRing &operator=(const SPSCRing &other) = delete;
+
+   /**
+    * \brief Push item, called by producer only.
+    * \return False when ring is full.
+    */
+   bool push(T item)
+   {
+      uint32_t tail = m_tail.load(std::memory_order_relaxed);
+      if (tail - m_head.load(std::memory_order_acquire) > m_mask) {
+         return false;
+      }
+      m_items[tail & m_mask] = item;
+      m_tail.store(tail + 1, std::memory_order_release);
+      return true;
+   }
+
+   /**
+    * \brief Pop item, called by consumer only.
+    * \return False when ring is empty.
+    */
+   bool pop(T &item)
+   {
+      uint32_t head = m_head.load(std::memory_order_relaxed);
+      if (head == m_tail.load(std::memory_order_acquire)) {
+         return false;
+      }
+      item = m_items[head & m_mask];
+      m_head.store(head + 1, std::memory_order_release);
+      return true;
+   }
+
+private:
+   T *m_items;
+   uint32_t m_mask;
+   char m_pad0[64];
+   std::atomic<uint32_t> m_head;
+   char m_pad1[64];
+   std::atomic<uint32_t> m_tail;
+   char m_pad2[64];
+};
+
+}
+#endif /* IPXP_SPSCRING_HPP */
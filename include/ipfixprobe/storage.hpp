@@ -55,6 +55,24 @@
 
 namespace ipxp {
 
+#define CACHE_STATS_REASONS 6 /**< Exported flow counters indexed by end reason, index 0 counts unknown reasons. */
+#define CACHE_STATS_PROBE_DEPTHS 8 /**< Probe depth histogram buckets: 1, 2, 3-4, 5-8, ..., 65 and more. */
+
+/**
+ * \brief Flow cache counters. Counters are updated by the thread owning the cache only.
+ */
+struct CacheStats {
+   uint64_t lookups; /**< Packets with a flow key looked up in the cache. */
+   uint64_t hits; /**< Lookups which found existing flow record. */
+   uint64_t empty; /**< New flows stored into an empty slot. */
+   uint64_t flushed; /**< Flows flushed on request of process plugins. */
+   uint64_t skipped; /**< Packets of flows not selected by flow sampling. */
+   uint64_t flows; /**< Flows stored in the cache. */
+   uint64_t size; /**< Number of cache slots. */
+   uint64_t exported[CACHE_STATS_REASONS]; /**< Exported flows by end reason. */
+   uint64_t probe_depth[CACHE_STATS_PROBE_DEPTHS]; /**< Hits by position of the flow in its line. */
+};
+
 /**
  * \brief Base class for flow caches.
  */
@@ -62,13 +80,14 @@ class StoragePlugin : public Plugin
 {
 protected:
    ipx_ring_t *m_export_queue;
+   ipx_ring_t *m_analytics_queue; /**< Queue of flows with deferred pre_export, nullptr when plugins run inline. */
 
 private:
    ProcessPlugin **m_plugins; /**< Array of plugins. */
    uint32_t m_plugin_cnt;
 
 public:
-   StoragePlugin() : m_export_queue(nullptr), m_plugins(nullptr), m_plugin_cnt(0)
+   StoragePlugin() : m_export_queue(nullptr), m_analytics_queue(nullptr), m_plugins(nullptr), m_plugin_cnt(0)
    {
    }
 
@@ -86,6 +105,28 @@ public:
     */
    virtual int put_pkt(Packet &pkt) = 0;
 
+   /**
+    * \brief Put block of packets into the cache. Packets are processed in order.
+    * \param [in] block Block of input parsed packets.
+    * \return 0 on success.
+    */
+   virtual int put_pkts(PacketBlock &block)
+   {
+      for (size_t i = 0; i < block.cnt; i++) {
+         put_pkt(block.pkts[i]);
+      }
+      return 0;
+   }
+
+   /**
+    * \brief Get block which the input fills instead of its own one. The block is taken over by the next put_pkts.
+    * \return Block or nullptr when the input uses its own block.
+    */
+   virtual PacketBlock *get_block()
+   {
+      return nullptr;
+   }
+
    /**
     * \brief Set export queue
     */
@@ -102,16 +143,69 @@ public:
       return m_export_queue;
    }
 
+   /**
+    * \brief Set queue of an analytics worker which finishes deferred pre_export of process plugins.
+    */
+   void set_analytics_queue(ipx_ring_t *queue)
+   {
+      m_analytics_queue = queue;
+   }
+
+   /**
+    * \brief Get analytics queue, nullptr when plugins run inline.
+    */
+   const ipx_ring_t *get_analytics_queue() const
+   {
+      return m_analytics_queue;
+   }
+
+   /**
+    * \brief Call pre_export functions deferred by plugins_pre_export and push the record to the export queue.
+    * Called by an analytics worker, concurrently with the thread which puts packets into the cache.
+    * \param [in,out] rec Flow record queued by plugins_pre_export.
+    */
+   void finish_deferred_export(Flow &rec)
+   {
+      uint64_t deferred = rec.deferred_plugins;
+      while (deferred) {
+         m_plugins[__builtin_ctzll(deferred)]->pre_export(rec);
+         deferred &= deferred - 1;
+      }
+      rec.deferred_plugins = 0;
+      rec.deferred = nullptr;
+      ipx_ring_push(m_export_queue, &rec);
+   }
+
    virtual void export_expired(time_t ts)
    {
    }
+
+   /**
+    * \brief Get cache counters. Must be called from the thread which puts packets into the cache.
+    * \param [out] stats Counters of the cache.
+    * \return False when the plugin does not maintain counters.
+    */
+   virtual bool get_stats(CacheStats &stats) const
+   {
+      return false;
+   }
+
+   /**
+    * \brief Get number of polls the thread putting packets spent waiting for the next stage.
+    * Must be called from the thread which puts packets into the cache.
+    */
+   virtual uint64_t get_waits() const
+   {
+      return 0;
+   }
    virtual void finish()
    {
    }
 
    /**
     * \brief Add plugin to internal list of plugins.
-    * Plugins are always called in the same order, as they were added.
+    * Plugins are always called in the same order, as they were added. Deferred pre_export
+    * functions are called after the other ones, in the same order.
     */
    void add_plugin(ProcessPlugin *plugin)
    {
@@ -132,6 +226,31 @@ public:
    }
 
 protected:
+   /**
+    * \brief Check whether any plugin was added.
+    */
+   bool has_plugins() const
+   {
+      return m_plugin_cnt != 0;
+   }
+
+   /**
+    * \brief Get number of added plugins.
+    */
+   uint32_t get_plugin_cnt() const
+   {
+      return m_plugin_cnt;
+   }
+
+   /**
+    * \brief Get added plugin.
+    * \param [in] idx Index of the plugin in order of addition.
+    */
+   const ProcessPlugin *get_plugin(uint32_t idx) const
+   {
+      return m_plugins[idx];
+   }
+
    //Every StoragePlugin implementation should call these functions at appropriate places
 
    /**
@@ -194,13 +313,21 @@ protected:
 
    /**
     * \brief Call pre_export function for each added plugin.
+    * With an analytics queue, expensive calls are deferred and the record is marked to be exported through the queue.
     * \param [in,out] rec Stored flow record.
     */
    void plugins_pre_export(Flow &rec)
    {
+      rec.deferred_plugins = 0;
       for (unsigned int i = 0; i < m_plugin_cnt; i++) {
+         // Plugins beyond the width of the mask always run inline
+         if (m_analytics_queue != nullptr && i < 64 && m_plugins[i]->defer_export(rec)) {
+            rec.deferred_plugins |= static_cast<uint64_t>(1) << i;
+            continue;
+         }
          m_plugins[i]->pre_export(rec);
       }
+      rec.deferred = rec.deferred_plugins ? this : nullptr;
    }
 };
 
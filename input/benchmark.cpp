@@ -50,6 +50,7 @@
 #include <ipfixprobe/plugin.hpp>
 #include <ipfixprobe/utils.hpp>
 #include <ipfixprobe/packet.hpp>
+#include <ipfixprobe/clock.hpp>
 
 namespace ipxp {
 
@@ -105,7 +106,7 @@ void Benchmark::init(const char *params)
       std::seed_seq seed (parser.m_seed.begin(),parser.m_seed.end());
       m_rndGen = std::mt19937(seed);
    }
-   gettimeofday(&m_firstTs, nullptr);
+   m_firstTs = CoarseClock::now();
 }
 
 void Benchmark::close()
@@ -114,7 +115,7 @@ void Benchmark::close()
 
 InputPlugin::Result Benchmark::get(PacketBlock &packets)
 {
-   gettimeofday(&m_currentTs, nullptr);
+   m_currentTs = CoarseClock::now();
    InputPlugin::Result res = check_constraints();
    if (res != InputPlugin::Result::PARSED) {
       return res;
@@ -46,6 +46,7 @@
 #include <rte_ethdev.h>
 #include <rte_version.h>
 #include <unistd.h>
+#include <sys/time.h>
 #include <rte_eal.h>
 #include <rte_errno.h>
 
@@ -58,6 +59,12 @@
 
 #define MEMPOOL_CACHE_SIZE 256
 
+#if RTE_VERSION >= RTE_VERSION_NUM(21, 11, 0, 0)
+#define DPDK_RX_RSS_HASH RTE_MBUF_F_RX_RSS_HASH
+#else
+#define DPDK_RX_RSS_HASH PKT_RX_RSS_HASH
+#endif
+
 namespace ipxp {
 __attribute__((constructor)) static void register_this_plugin()
 {
@@ -227,8 +234,15 @@ void DpdkCore::configureRSS()
     };
 
     if (rte_eth_dev_rss_hash_update(m_portId, &rssConfig)) {
-        std::cerr << "Setting RSS hash for port " << m_portId << "." << std::endl;
+        std::cerr << "Unable to set symmetric RSS hash key for port " << m_portId << ", RSS hash is asymmetric." << std::endl;
+        return;
     }
+    m_symmetricRSS = true;
+}
+
+bool DpdkCore::isRssSymmetric()
+{
+    return m_symmetricRSS;
 }
 
 void DpdkCore::enablePort()
@@ -423,7 +437,7 @@ void DpdkReader::setupRxQueue()
     }
 }
 
-struct timeval DpdkReader::getTimestamp(rte_mbuf* mbuf)
+struct timeval DpdkReader::getTimestamp(rte_mbuf* mbuf, const struct timeval& rxTime)
 {
 	struct timeval tv;
     if (m_useHwRxTimestamp && (mbuf->ol_flags & m_rxTimestampDynflag)) {
@@ -436,15 +450,8 @@ struct timeval DpdkReader::getTimestamp(rte_mbuf* mbuf)
 
         return tv;
     } else {
-        auto now = std::chrono::system_clock::now();
-        auto now_t = std::chrono::system_clock::to_time_t(now);
-
-        auto dur = now - std::chrono::system_clock::from_time_t(now_t);
-        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(dur).count();
-
-	    tv.tv_sec = now_t;
-		tv.tv_usec = micros;
-        return tv;	
+        // Packets of one burst share the software timestamp
+        return rxTime;
     }
 
 } 
@@ -466,6 +473,11 @@ InputPlugin::Result DpdkReader::get(PacketBlock& packets)
     if (pkts_read_ == 0) {
         return Result::TIMEOUT;
     }
+    struct timeval rxTime;
+    gettimeofday(&rxTime, nullptr);
+#ifndef WITH_FLEXPROBE
+    const RxHash rssHashType = m_dpdkCore.isRssSymmetric() ? RxHash::SYMMETRIC : RxHash::ASYMMETRIC;
+#endif
 
     for (auto i = 0; i < pkts_read_; i++) {
 #ifdef WITH_FLEXPROBE
@@ -480,8 +492,11 @@ InputPlugin::Result DpdkReader::get(PacketBlock& packets)
         m_parsed++;
         packets.cnt++;
 #else
+        // RSS is symmetric only when configureRSS installed its key
+        opt.rx_hash = mbufs_[i]->hash.rss;
+        opt.rx_hash_type = (mbufs_[i]->ol_flags & DPDK_RX_RSS_HASH) ? rssHashType : RxHash::NONE;
         parse_packet(&opt,
-            getTimestamp(mbufs_[i]),
+            getTimestamp(mbufs_[i], rxTime),
             rte_pktmbuf_mtod(mbufs_[i], const std::uint8_t*),
             rte_pktmbuf_data_len(mbufs_[i]),
             rte_pktmbuf_data_len(mbufs_[i]));
@@ -145,6 +145,13 @@ public:
 
     bool isNfbDpdkDriver();
 
+    /**
+     * @brief Check whether the symmetric RSS key was installed, valid once the port is ready
+     * 
+     * @return true when both directions of a connection get the same RSS hash
+     */
+    bool isRssSymmetric();
+
     /**
      * @brief Start receiving on port when all lcores are ready
      * 
@@ -186,6 +193,7 @@ private:
     bool m_isNfbDpdkDriver;
     bool m_supportedRSS;
     bool m_supportedHWTimestamp;
+    bool m_symmetricRSS = false;
     
     bool isConfigured = false;
     static DpdkCore* m_instance;
@@ -228,7 +236,7 @@ private:
     void createRteMempool(uint16_t mempoolSize);
     void createRteMbufs(uint16_t mbufsSize);
     void setupRxQueue();
-    struct timeval getTimestamp(rte_mbuf* mbuf);
+    struct timeval getTimestamp(rte_mbuf* mbuf, const struct timeval& rxTime);
 
     DpdkCore& m_dpdkCore;
 };
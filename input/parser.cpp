@@ -113,6 +113,9 @@ inline uint16_t parse_eth_hdr(const u_char *data_ptr, uint16_t data_len, Packet
       DEBUG_MSG("\t\tCFI:\t\t%u\n",       ((vlan & 0x1000) >> 11));
       DEBUG_MSG("\t\tVLAN:\t\t%u\n",      (vlan & 0x0FFF));
 
+      if (pkt->vlan_id == 0) {
+         pkt->vlan_id = ntohs(*(uint16_t *) (data_ptr + hdr_len)) & 0x0FFF;
+      }
       hdr_len += 4;
       ethertype = ntohs(*(uint16_t *) (data_ptr + hdr_len - 2));
       DEBUG_MSG("\t\tEthertype:\t%#06x\n", ethertype);
@@ -127,6 +130,9 @@ inline uint16_t parse_eth_hdr(const u_char *data_ptr, uint16_t data_len, Packet
       DEBUG_MSG("\t\tCFI:\t\t%u\n",       ((vlan & 0x1000) >> 11));
       DEBUG_MSG("\t\tVLAN:\t\t%u\n",      (vlan & 0x0FFF));
 
+      if (pkt->vlan_id == 0) {
+         pkt->vlan_id = ntohs(*(uint16_t *) (data_ptr + hdr_len)) & 0x0FFF;
+      }
       hdr_len += 4;
       ethertype = ntohs(*(uint16_t *) (data_ptr + hdr_len - 2));
       DEBUG_MSG("\t\tEthertype:\t%#06x\n", ethertype);
@@ -562,6 +568,7 @@ uint16_t process_mpls(const u_char *data_ptr, uint16_t data_len, Packet *pkt)
 {
    Packet tmp;
    uint16_t length = process_mpls_stack(data_ptr, data_len);
+   pkt->mpls_label = ntohl(*(uint32_t *) data_ptr) >> 12;
    uint8_t next_hdr = (*(data_ptr + length) & 0xF0) >> 4;
 
    if (next_hdr == IP::v4) {
@@ -645,10 +652,14 @@ void parse_packet(parser_opt_t *opt, struct timeval ts, const uint8_t *data, uin
    pkt->ip_flags = 0;
    pkt->ip_version = 0;
    pkt->ip_payload_len = 0;
+   pkt->vlan_id = 0;
+   pkt->mpls_label = 0;
    pkt->tcp_flags = 0;
    pkt->tcp_window = 0;
    pkt->tcp_options = 0;
    pkt->tcp_mss = 0;
+   pkt->rx_hash = opt->rx_hash;
+   pkt->rx_hash_type = opt->rx_hash_type;
 
    uint32_t l3_hdr_offset = 0;
    uint32_t l4_hdr_offset = 0;
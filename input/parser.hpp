@@ -78,6 +78,8 @@ typedef struct parser_opt_s {
    bool packet_valid;
    bool parse_all;
    int datalink;
+   uint32_t rx_hash; /**< Hash of the next parsed packet provided by input */
+   RxHash rx_hash_type; /**< Kind of rx_hash, NONE when input has no hash */
 } parser_opt_t;
 
 void parse_packet(parser_opt_t *opt, struct timeval ts, const uint8_t *data, uint16_t len, uint16_t caplen);
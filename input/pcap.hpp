@@ -103,6 +103,7 @@ public:
    OptionsParser *get_parser() const { return new PcapOptParser(); }
    std::string get_name() const { return "pcap"; }
    InputPlugin::Result get(PacketBlock &packets);
+   int get_fd() const { return m_live ? pcap_get_selectable_fd(m_handle) : -1; }
 
 private:
    pcap_t *m_handle;          /**< libpcap file handle */
@@ -324,7 +324,15 @@ int RawReader::process_packets(struct tpacket_block_desc *pbd, PacketBlock &pack
       size_t snaplen = ppd->tp_snaplen;
       struct timeval ts = {ppd->tp_sec, ppd->tp_nsec / 1000};
 
+      // Kernel reports hash of NIC when there is one, so symmetry cannot be relied on
+      opt.rx_hash = ppd->hv1.tp_rxhash;
+      opt.rx_hash_type = RxHash::ASYMMETRIC;
+      size_t cnt = packets.cnt;
       parse_packet(&opt, ts, data, len, snaplen);
+      if (packets.cnt > cnt && (ppd->tp_status & TP_STATUS_VLAN_VALID)) {
+         // Outer tag stripped by the kernel is not in the frame
+         packets.pkts[cnt].vlan_id = ppd->hv1.tp_vlan_tci & 0x0FFF;
+      }
       ppd = (struct tpacket3_hdr *) ((uint8_t *) ppd + ppd->tp_next_offset);
    }
    m_last_ppd = ppd;
@@ -54,6 +54,8 @@
 #include <signal.h>
 #include <poll.h>
 
+#include <ipfixprobe/clock.hpp>
+
 #include "ipfixprobe.hpp"
 #ifdef WITH_LIBUNWIND
 #include "stacktrace.hpp"
@@ -65,6 +67,7 @@ namespace ipxp {
 volatile sig_atomic_t stop = 0;
 
 volatile sig_atomic_t terminate_export = 0;
+volatile sig_atomic_t terminate_analytics = 0;
 volatile sig_atomic_t terminate_input = 0;
 
 const uint32_t DEFAULT_IQUEUE_SIZE = 64;
@@ -167,6 +170,76 @@ void process_plugin_argline(const std::string &args, std::string &plugin, std::s
    trim_str(params);
 }
 
+/**
+ * \brief Get CPUs of N-th thread of a kind. Single list is spread over the threads, one CPU per thread,
+ * otherwise each thread has its own list.
+ */
+static std::vector<unsigned> thread_cpus(const std::vector<std::vector<unsigned>> &lists, size_t idx)
+{
+   if (lists.empty()) {
+      return std::vector<unsigned>();
+   }
+   if (lists.size() == 1) {
+      return std::vector<unsigned>(1, lists[0][idx % lists[0].size()]);
+   }
+   return lists[idx % lists.size()];
+}
+
+/**
+ * \brief Start storage thread processing packets of a dispatcher shard.
+ * \return True when plugin requested exit.
+ */
+static bool start_storage_worker(ipxp_conf_t &conf, const std::string &storage_name, const std::string &storage_params,
+   OutputPlugin::Plugins &process_plugins, Dispatcher *dispatcher, size_t shard, ipx_ring_t *output_queue,
+   ipx_ring_t *analytics_queue)
+{
+   StoragePlugin *storage_plugin = nullptr;
+   std::vector<ProcessPlugin *> storage_process_plugins;
+   try {
+      storage_plugin = dynamic_cast<StoragePlugin *>(conf.mgr.get(storage_name));
+      if (storage_plugin == nullptr) {
+         throw IPXPError("invalid storage plugin " + storage_name);
+      }
+      storage_plugin->set_queue(output_queue);
+      storage_plugin->set_analytics_queue(analytics_queue);
+      // Plugins are added before init, so that flows restored by the storage get their extensions
+      for (auto &it : process_plugins) {
+         ProcessPlugin *tmp = it.second->copy();
+         storage_plugin->add_plugin(tmp);
+         conf.active.process.push_back(tmp);
+         conf.active.all.push_back(tmp);
+         storage_process_plugins.push_back(tmp);
+      }
+      storage_plugin->init(storage_params.c_str());
+      conf.active.storage.push_back(storage_plugin);
+      conf.active.all.push_back(storage_plugin);
+   } catch (PluginError &e) {
+      delete storage_plugin;
+      throw IPXPError(storage_name + std::string(": ") + e.what());
+   } catch (PluginExit &e) {
+      delete storage_plugin;
+      return true;
+   } catch (PluginManagerError &e) {
+      throw IPXPError(storage_name + std::string(": ") + e.what());
+   }
+
+   std::promise<WorkerResult> *storage_res = new std::promise<WorkerResult>();
+   conf.storage_fut.push_back(storage_res->get_future());
+
+   auto cache_stats = new SharedCacheStats();
+   conf.cache_stats.push_back(cache_stats);
+
+   StorageWorker tmp = {
+      storage_plugin,
+      storage_process_plugins,
+      new std::thread(storage_worker, storage_plugin, dispatcher, shard, storage_res, cache_stats, conf.idle),
+      storage_res,
+      cache_stats
+   };
+   conf.storages.push_back(tmp);
+   return false;
+}
+
 bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser)
 {
    auto deleter = [&](OutputPlugin::Plugins *p) {
@@ -222,52 +295,101 @@ bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser)
       }
    }
 
-   // Output
-   ipx_ring_t *output_queue = ipx_ring_init(conf.oqueue_size, 1);
-   if (output_queue == nullptr) {
-      throw IPXPError("unable to initialize ring buffer");
+   // Threads without explicit CPUs run on the NUMA node, memory of all threads prefers it
+   std::unique_ptr<CpuBinding> numa_binding;
+   if (conf.numa_node >= 0) {
+      prefer_numa_node(conf.numa_node);
+      numa_binding.reset(new CpuBinding(get_numa_node_cpus(conf.numa_node)));
    }
-   OutputPlugin *output_plugin = nullptr;
-   try {
-      output_plugin = dynamic_cast<OutputPlugin *>(conf.mgr.get(output_name));
-      if (output_plugin == nullptr) {
-         ipx_ring_destroy(output_queue);
-         throw IPXPError("invalid output plugin " + output_name);
-      }
 
-      output_plugin->init(output_params.c_str(), *process_plugins);
-      conf.active.output.push_back(output_plugin);
-      conf.active.all.push_back(output_plugin);
-   } catch (PluginError &e) {
-      ipx_ring_destroy(output_queue);
-      delete output_plugin;
-      throw IPXPError(output_name + std::string(": ") + e.what());
-   } catch (PluginExit &e) {
-      ipx_ring_destroy(output_queue);
-      delete output_plugin;
-      return true;
-   } catch (PluginManagerError &e) {
-      throw IPXPError(output_name + std::string(": ") + e.what());
+   // Output workers, each with its own queue and exporter instance
+   std::vector<ipx_ring_t *> output_queues;
+   uint32_t output_fps = conf.fps / conf.outputs_cnt;
+   if (conf.fps != 0 && output_fps == 0) {
+      output_fps = 1;
    }
+   for (uint32_t output_idx = 0; output_idx < conf.outputs_cnt; output_idx++) {
+      CpuBinding binding(thread_cpus(conf.output_cpus, output_idx));
+      ipx_ring_t *output_queue = ipx_ring_init(conf.oqueue_size, 1);
+      if (output_queue == nullptr) {
+         throw IPXPError("unable to initialize ring buffer");
+      }
+      OutputPlugin *output_plugin = nullptr;
+      try {
+         output_plugin = dynamic_cast<OutputPlugin *>(conf.mgr.get(output_name));
+         if (output_plugin == nullptr) {
+            ipx_ring_destroy(output_queue);
+            throw IPXPError("invalid output plugin " + output_name);
+         }
+
+         output_plugin->m_worker_id = output_idx;
+         output_plugin->m_worker_cnt = conf.outputs_cnt;
+         output_plugin->init(output_params.c_str(), *process_plugins);
+         conf.active.output.push_back(output_plugin);
+         conf.active.all.push_back(output_plugin);
+      } catch (PluginError &e) {
+         ipx_ring_destroy(output_queue);
+         delete output_plugin;
+         throw IPXPError(output_name + std::string(": ") + e.what());
+      } catch (PluginExit &e) {
+         ipx_ring_destroy(output_queue);
+         delete output_plugin;
+         return true;
+      } catch (PluginManagerError &e) {
+         throw IPXPError(output_name + std::string(": ") + e.what());
+      }
 
-   {
       std::promise<WorkerResult> *output_res = new std::promise<WorkerResult>();
       auto output_stats = new std::atomic<OutputStats>();
       conf.output_stats.push_back(output_stats);
       OutputWorker tmp = {
               output_plugin,
-              new std::thread(output_worker, output_plugin, output_queue, output_res, output_stats, conf.fps),
+              new std::thread(output_worker, output_plugin, output_queue, output_res, output_stats, output_fps, conf.idle),
               output_res,
               output_stats,
               output_queue
       };
       conf.outputs.push_back(tmp);
       conf.output_fut.push_back(output_res->get_future());
+      output_queues.push_back(output_queue);
+   }
+
+   // Analytics workers finish deferred pre_export and push flows to the export queue of their storage
+   std::vector<ipx_ring_t *> analytics_queues;
+   for (uint32_t analytics_idx = 0; analytics_idx < conf.analytics_cnt; analytics_idx++) {
+      CpuBinding binding(thread_cpus(conf.analytics_cpus, analytics_idx));
+      ipx_ring_t *analytics_queue = ipx_ring_init(conf.oqueue_size, 1);
+      if (analytics_queue == nullptr) {
+         throw IPXPError("unable to initialize ring buffer");
+      }
+      AnalyticsWorker tmp = {
+         new std::thread(analytics_worker, analytics_queue, conf.idle),
+         analytics_queue
+      };
+      conf.analytics.push_back(tmp);
+      analytics_queues.push_back(analytics_queue);
+   }
+   auto analytics_queue = [&analytics_queues](size_t idx) -> ipx_ring_t * {
+      return analytics_queues.empty() ? nullptr : analytics_queues[idx % analytics_queues.size()];
+   };
+
+   // Storage shards
+   if (conf.shards) {
+      Dispatcher *dispatcher = new Dispatcher(parser.m_input.size(), conf.shards, conf.iqueue_size, conf.pkt_bufsize, conf.idle);
+      conf.dispatchers.push_back(dispatcher);
+      for (size_t shard = 0; shard < conf.shards; shard++) {
+         CpuBinding binding(thread_cpus(conf.storage_cpus, shard));
+         if (start_storage_worker(conf, storage_name, storage_params, *process_plugins, dispatcher, shard,
+               output_queues[shard % output_queues.size()], analytics_queue(shard))) {
+            return true;
+         }
+      }
    }
 
    // Input
    size_t pipeline_idx = 0;
    for (auto &it : parser.m_input) {
+      CpuBinding binding(thread_cpus(conf.input_cpus, pipeline_idx));
       InputPlugin *input_plugin = nullptr;
       StoragePlugin *storage_plugin = nullptr;
       std::string input_params;
@@ -292,32 +414,55 @@ bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser)
          throw IPXPError(input_name + std::string(": ") + e.what());
       }
 
-      try {
-         storage_plugin = dynamic_cast<StoragePlugin *>(conf.mgr.get(storage_name));
-         if (storage_plugin == nullptr) {
-            throw IPXPError("invalid storage plugin " + storage_name);
+      std::vector<ProcessPlugin *> storage_process_plugins;
+      SharedCacheStats *cache_stats = nullptr;
+      ipx_ring_t *output_queue = output_queues[pipeline_idx % output_queues.size()];
+      if (conf.shards) {
+         // Flows are stored by shards, input only dispatches packets
+         storage_plugin = new DispatchStorage(conf.dispatchers[0], pipeline_idx);
+         storage_plugin->set_queue(output_queue);
+      } else if (conf.split) {
+         // Input thread only captures and parses, flows are stored by its own storage thread
+         Dispatcher *dispatcher = new Dispatcher(1, 1, conf.iqueue_size, conf.pkt_bufsize, conf.idle);
+         conf.dispatchers.push_back(dispatcher);
+         CpuBinding storage_binding(thread_cpus(conf.storage_cpus, pipeline_idx));
+         if (start_storage_worker(conf, storage_name, storage_params, *process_plugins, dispatcher, 0, output_queue,
+               analytics_queue(pipeline_idx))) {
+            return true;
          }
+         storage_plugin = new DispatchStorage(dispatcher, 0);
          storage_plugin->set_queue(output_queue);
-         storage_plugin->init(storage_params.c_str());
-         conf.active.storage.push_back(storage_plugin);
-         conf.active.all.push_back(storage_plugin);
-      } catch (PluginError &e) {
-         delete storage_plugin;
-         throw IPXPError(storage_name + std::string(": ") + e.what());
-      } catch (PluginExit &e) {
-         delete storage_plugin;
-         return true;
-      } catch (PluginManagerError &e) {
-         throw IPXPError(storage_name + std::string(": ") + e.what());
-      }
+      } else {
+         try {
+            storage_plugin = dynamic_cast<StoragePlugin *>(conf.mgr.get(storage_name));
+            if (storage_plugin == nullptr) {
+               throw IPXPError("invalid storage plugin " + storage_name);
+            }
+            storage_plugin->set_queue(output_queue);
+            storage_plugin->set_analytics_queue(analytics_queue(pipeline_idx));
+            // Plugins are added before init, so that flows restored by the storage get their extensions
+            for (auto &it : *process_plugins) {
+               ProcessPlugin *tmp = it.second->copy();
+               storage_plugin->add_plugin(tmp);
+               conf.active.process.push_back(tmp);
+               conf.active.all.push_back(tmp);
+               storage_process_plugins.push_back(tmp);
+            }
+            storage_plugin->init(storage_params.c_str());
+            conf.active.storage.push_back(storage_plugin);
+            conf.active.all.push_back(storage_plugin);
+         } catch (PluginError &e) {
+            delete storage_plugin;
+            throw IPXPError(storage_name + std::string(": ") + e.what());
+         } catch (PluginExit &e) {
+            delete storage_plugin;
+            return true;
+         } catch (PluginManagerError &e) {
+            throw IPXPError(storage_name + std::string(": ") + e.what());
+         }
 
-      std::vector<ProcessPlugin *> storage_process_plugins;
-      for (auto &it : *process_plugins) {
-         ProcessPlugin *tmp = it.second->copy();
-         storage_plugin->add_plugin(tmp);
-         conf.active.process.push_back(tmp);
-         conf.active.all.push_back(tmp);
-         storage_process_plugins.push_back(tmp);
+         cache_stats = new SharedCacheStats();
+         conf.cache_stats.push_back(cache_stats);
       }
 
       std::promise<WorkerResult> *input_res = new std::promise<WorkerResult>();
@@ -330,13 +475,14 @@ bool process_plugin_args(ipxp_conf_t &conf, IpfixprobeOptParser &parser)
          {
             input_plugin,
             new std::thread(input_storage_worker, input_plugin, storage_plugin, conf.iqueue_size, 
-               conf.max_pkts, input_res, input_stats),
+               conf.max_pkts, input_res, input_stats, cache_stats, pipeline_idx, conf.idle),
             input_res,
             input_stats
          },
          {
             storage_plugin,
-            storage_process_plugins
+            storage_process_plugins,
+            cache_stats
          }
       };
       conf.pipelines.push_back(tmp);
@@ -357,12 +503,35 @@ void finish(ipxp_conf_t &conf)
       it.input.plugin->close();
    }
 
+   // Wait for storage shards, they finish when all inputs are finished
+   for (auto &it : conf.storages) {
+      it.thread->join();
+   }
+   for (auto &it : conf.storage_fut) {
+      WorkerResult res = it.get();
+      if (res.error) {
+         ok = false;
+         std::cerr << "storage: " << res.msg << std::endl;
+      }
+   }
+
+   // Flows exported by storages may wait for analytics workers, which call pre_export of process plugins
+   terminate_analytics = 1;
+   for (auto &it : conf.analytics) {
+      it.thread->join();
+   }
+
    // Terminate all storages
    for (auto &it : conf.pipelines) {
       for (auto &itp : it.storage.plugins) {
          itp->close();
       }
    }
+   for (auto &it : conf.storages) {
+      for (auto &itp : it.plugins) {
+         itp->close();
+      }
+   }
 
    // Terminate all outputs
    terminate_export = 1;
@@ -373,6 +542,9 @@ void finish(ipxp_conf_t &conf)
    for (auto &it : conf.pipelines) {
       it.storage.plugin->close();
    }
+   for (auto &it : conf.storages) {
+      it.plugin->close();
+   }
 
    std::cout << "Input stats:" << std::endl <<
       std::setw(3) << "#" <<
@@ -381,6 +553,8 @@ void finish(ipxp_conf_t &conf)
       std::setw(20) << "bytes" <<
       std::setw(13) << "dropped" <<
       std::setw(16) << "qtime" <<
+      std::setw(13) << "busy" <<
+      std::setw(13) << "idle" <<
       std::setw(7) << "status" << std::endl;
 
    int idx = 0;
@@ -389,6 +563,8 @@ void finish(ipxp_conf_t &conf)
    uint64_t total_bytes = 0;
    uint64_t total_dropped = 0;
    uint64_t total_qtime = 0;
+   uint64_t total_busy = 0;
+   uint64_t total_idle = 0;
 
    for (auto &it : conf.input_fut) {
       WorkerResult res = it.get();
@@ -405,12 +581,16 @@ void finish(ipxp_conf_t &conf)
          std::setw(19) << stats.bytes << " " <<
          std::setw(12) << stats.dropped << " " <<
          std::setw(15) << stats.qtime << " " <<
+         std::setw(12) << stats.busy << " " <<
+         std::setw(12) << stats.idle << " " <<
          std::setw(6) << status << std::endl;
       total_packets += stats.packets;
       total_parsed += stats.parsed;
       total_bytes += stats.bytes;
       total_dropped += stats.dropped;
       total_qtime += stats.qtime;
+      total_busy += stats.busy;
+      total_idle += stats.idle;
    }
 
    std::cout <<
@@ -419,7 +599,9 @@ void finish(ipxp_conf_t &conf)
       std::setw(13) << total_parsed <<
       std::setw(20) << total_bytes <<
       std::setw(13) << total_dropped <<
-      std::setw(16) << total_qtime << std::endl;
+      std::setw(16) << total_qtime <<
+      std::setw(13) << total_busy <<
+      std::setw(13) << total_idle << std::endl;
 
    std::cout << std::endl;
 
@@ -429,6 +611,8 @@ void finish(ipxp_conf_t &conf)
       std::setw(13) << "packets" <<
       std::setw(20) << "bytes (L4)" <<
       std::setw(13) << "dropped" <<
+      std::setw(13) << "busy" <<
+      std::setw(13) << "idle" <<
       std::setw(7) << "status" << std::endl;
 
    idx = 0;
@@ -446,9 +630,20 @@ void finish(ipxp_conf_t &conf)
          std::setw(12) << stats.packets << " " <<
          std::setw(19) << stats.bytes << " " <<
          std::setw(12) << stats.dropped << " " <<
+         std::setw(12) << stats.busy << " " <<
+         std::setw(12) << stats.idle << " " <<
          std::setw(6) << status << std::endl;
    }
 
+   if (!conf.cache_stats.empty()) {
+      std::vector<CacheStats> cache_stats;
+      for (auto &it : conf.cache_stats) {
+         cache_stats.push_back(it->load());
+      }
+      std::cout << std::endl;
+      print_cache_stats(std::cout, cache_stats.data(), cache_stats.size());
+   }
+
    if (!ok) {
       throw IPXPError("one of the plugins exitted unexpectedly");
    }
@@ -485,11 +680,17 @@ void serve_stat_clients(ipxp_conf_t &conf, struct pollfd pfds[2])
             *(OutputStats *)(buffer + written) = stats;
             written += sizeof(OutputStats);
          }
+         for (auto &it : conf.cache_stats) {
+            CacheStats stats = it->load();
+            *(CacheStats *)(buffer + written) = stats;
+            written += sizeof(CacheStats);
+         }
 
          hdr->magic = MSG_MAGIC;
          hdr->size = written - sizeof(msg_header_t);
          hdr->inputs = conf.input_stats.size();
          hdr->outputs = conf.output_stats.size();
+         hdr->caches = conf.cache_stats.size();
 
          send_data(pfds[1].fd, written, buffer);
       }
@@ -546,6 +747,14 @@ void main_loop(ipxp_conf_t &conf)
             break;
          }
       }
+      for (auto &it : conf.storage_fut) {
+         // Storage shards finish before all inputs only on error, split storage finishes with its input
+         std::future_status status = it.wait_for(std::chrono::seconds(0));
+         if (status == std::future_status::ready && it.get().error) {
+            stop = 1;
+            break;
+         }
+      }
 
       usleep(1000);
    }
@@ -627,6 +836,47 @@ int run(int argc, char *argv[])
       status = EXIT_FAILURE;
       goto EXIT;
    }
+   if (parser.m_split && parser.m_shards) {
+      error("split pipelines cannot be combined with shards, shards already run flow cache in own threads");
+      status = EXIT_FAILURE;
+      goto EXIT;
+   }
+   if (parser.m_input_cpus.size() > 1 && parser.m_input_cpus.size() != parser.m_input.size()) {
+      error("specify input CPUs once or for each input");
+      status = EXIT_FAILURE;
+      goto EXIT;
+   }
+   if (parser.m_storage_cpus.size() && !parser.m_shards && !parser.m_split) {
+      error("storage CPUs require flow cache threads, use --shards or --split");
+      status = EXIT_FAILURE;
+      goto EXIT;
+   }
+   if (parser.m_storage_cpus.size() > 1 &&
+         parser.m_storage_cpus.size() != (parser.m_shards ? parser.m_shards : parser.m_input.size())) {
+      error("specify storage CPUs once or for each flow cache thread");
+      status = EXIT_FAILURE;
+      goto EXIT;
+   }
+   if (parser.m_output_cpus.size() > 1 && parser.m_output_cpus.size() != parser.m_outputs) {
+      error("specify output CPUs once or for each output worker");
+      status = EXIT_FAILURE;
+      goto EXIT;
+   }
+   if (parser.m_analytics_cpus.size() && !parser.m_analytics) {
+      error("analytics CPUs require analytics threads, use --analytics");
+      status = EXIT_FAILURE;
+      goto EXIT;
+   }
+   if (parser.m_analytics_cpus.size() > 1 && parser.m_analytics_cpus.size() != parser.m_analytics) {
+      error("specify analytics CPUs once or for each analytics thread");
+      status = EXIT_FAILURE;
+      goto EXIT;
+   }
+   if (parser.m_outputs < 1) {
+      error("at least one output worker is required");
+      status = EXIT_FAILURE;
+      goto EXIT;
+   }
 
    conf.worker_cnt = parser.m_input.size();
    conf.iqueue_size = parser.m_iqueue;
@@ -634,8 +884,19 @@ int run(int argc, char *argv[])
    conf.fps = parser.m_fps;
    conf.pkt_bufsize = parser.m_pkt_bufsize;
    conf.max_pkts = parser.m_max_pkts;
+   conf.shards = parser.m_shards;
+   conf.outputs_cnt = parser.m_outputs;
+   conf.split = parser.m_split;
+   conf.analytics_cnt = parser.m_analytics;
+   conf.numa_node = parser.m_numa_node;
+   conf.idle = parser.m_idle;
+   conf.input_cpus = parser.m_input_cpus;
+   conf.storage_cpus = parser.m_storage_cpus;
+   conf.output_cpus = parser.m_output_cpus;
+   conf.analytics_cpus = parser.m_analytics_cpus;
 
    try {
+      CoarseClock::start();
       if (process_plugin_args(conf, parser)) {
          goto EXIT;
       }
@@ -655,6 +916,7 @@ int run(int argc, char *argv[])
    }
 
 EXIT:
+   CoarseClock::stop();
    if (!parser.m_pid.empty()) {
       unlink(parser.m_pid.c_str());
    }
@@ -71,6 +71,7 @@ extern const uint32_t DEFAULT_FPS;
 
 // global termination variable
 extern volatile sig_atomic_t terminate_export;
+extern volatile sig_atomic_t terminate_analytics;
 extern volatile sig_atomic_t terminate_input;
 
 class IpfixprobeOptParser;
@@ -98,6 +99,16 @@ public:
    uint32_t m_fps;
    uint32_t m_pkt_bufsize;
    uint32_t m_max_pkts;
+   uint32_t m_shards;
+   uint32_t m_outputs;
+   bool m_split;
+   uint32_t m_analytics;
+   std::vector<std::vector<unsigned>> m_input_cpus;
+   std::vector<std::vector<unsigned>> m_storage_cpus;
+   std::vector<std::vector<unsigned>> m_output_cpus;
+   std::vector<std::vector<unsigned>> m_analytics_cpus;
+   int m_numa_node;
+   IdleConfig m_idle;
    bool m_help;
    std::string m_help_str;
    bool m_version;
@@ -105,7 +116,7 @@ public:
    IpfixprobeOptParser() : OptionsParser("ipfixprobe", "flow exporter supporting various custom IPFIX elements"),
                            m_pid(""), m_daemon(false),
                            m_iqueue(DEFAULT_IQUEUE_SIZE), m_oqueue(DEFAULT_OQUEUE_SIZE), m_fps(DEFAULT_FPS),
-                           m_pkt_bufsize(1600), m_max_pkts(0), m_help(false), m_help_str(""), m_version(false)
+                           m_pkt_bufsize(1600), m_max_pkts(0), m_shards(0), m_outputs(1), m_split(false), m_analytics(0), m_numa_node(-1), m_help(false), m_help_str(""), m_version(false)
    {
       m_delim = ' ';
 
@@ -159,6 +170,74 @@ public:
                                   std::invalid_argument &e) { return false; }
                           return true;
                       }, OptionFlags::RequiredArgument);
+      register_option("-n", "--shards", "NUM", "Number of flow cache threads. Packets of all inputs are dispatched to them by flow hash (default: cache per input)",
+                      [this](const char *arg) {
+                          try { m_shards = str2num<decltype(m_shards)>(arg); } catch (
+                                  std::invalid_argument &e) { return false; }
+                          return true;
+                      }, OptionFlags::RequiredArgument);
+      register_option("-w", "--outputs", "NUM", "Number of output worker threads with own exporter instance. Inputs (or shards) are assigned to them round-robin",
+                      [this](const char *arg) {
+                          try { m_outputs = str2num<decltype(m_outputs)>(arg); } catch (
+                                  std::invalid_argument &e) { return false; }
+                          return true;
+                      }, OptionFlags::RequiredArgument);
+      register_option("-S", "--split", "", "Run flow cache and process plugins of each input in own thread, input thread only captures and parses packets",
+                      [this](const char *arg) {
+                          m_split = true;
+                          return true;
+                      }, OptionFlags::NoArgument);
+      register_option("-e", "--analytics", "NUM", "Number of analytics worker threads finishing expensive export-time computations of process plugins (e.g. timeseries) before flows are exported (default: computed by flow cache threads)",
+                      [this](const char *arg) {
+                          try { m_analytics = str2num<decltype(m_analytics)>(arg); } catch (
+                                  std::invalid_argument &e) { return false; }
+                          return true;
+                      }, OptionFlags::RequiredArgument);
+      register_option("-a", "--input-cpus", "CPUS", "CPUs of input threads, e.g. 0-3,8. Given once, input N runs on N-th CPU of the list. Given for each input, input N runs on N-th list",
+                      [this](const char *arg) {
+                          try { m_input_cpus.push_back(parse_cpu_list(arg)); } catch (
+                                  std::invalid_argument &e) { return false; }
+                          return true;
+                      }, OptionFlags::RequiredArgument);
+      register_option("-A", "--storage-cpus", "CPUS", "CPUs of flow cache threads created by --shards or --split, assigned as --input-cpus",
+                      [this](const char *arg) {
+                          try { m_storage_cpus.push_back(parse_cpu_list(arg)); } catch (
+                                  std::invalid_argument &e) { return false; }
+                          return true;
+                      }, OptionFlags::RequiredArgument);
+      register_option("-O", "--output-cpus", "CPUS", "CPUs of output threads, assigned as --input-cpus",
+                      [this](const char *arg) {
+                          try { m_output_cpus.push_back(parse_cpu_list(arg)); } catch (
+                                  std::invalid_argument &e) { return false; }
+                          return true;
+                      }, OptionFlags::RequiredArgument);
+      register_option("-E", "--analytics-cpus", "CPUS", "CPUs of analytics threads created by --analytics, assigned as --input-cpus",
+                      [this](const char *arg) {
+                          try { m_analytics_cpus.push_back(parse_cpu_list(arg)); } catch (
+                                  std::invalid_argument &e) { return false; }
+                          return true;
+                      }, OptionFlags::RequiredArgument);
+      register_option("-N", "--numa", "NODE", "Run threads without explicit CPUs on CPUs of NUMA node and prefer the node for all memory",
+                      [this](const char *arg) {
+                          try { m_numa_node = str2num<decltype(m_numa_node)>(arg); } catch (
+                                  std::invalid_argument &e) { return false; }
+                          return m_numa_node >= 0 && m_numa_node < 64;
+                      }, OptionFlags::RequiredArgument);
+      register_option("-y", "--idle", "SPIN,YIELD,USEC", "Idle workers poll SPIN times busily, then YIELD times giving up the CPU, then block on descriptor of input or queue, or sleep up to USEC microseconds (default: 64,64,100)",
+                      [this](const char *arg) {
+                          std::string str(arg);
+                          size_t first = str.find(',');
+                          size_t second = first == std::string::npos ? first : str.find(',', first + 1);
+                          if (second == std::string::npos) {
+                             return false;
+                          }
+                          try {
+                             m_idle.spin = str2num<decltype(m_idle.spin)>(str.substr(0, first));
+                             m_idle.yield = str2num<decltype(m_idle.yield)>(str.substr(first + 1, second - first - 1));
+                             m_idle.sleep = str2num<decltype(m_idle.sleep)>(str.substr(second + 1));
+                          } catch (std::invalid_argument &e) { return false; }
+                          return m_idle.sleep > 0;
+                      }, OptionFlags::RequiredArgument);
       register_option("-P", "--pid", "FILE", "Create pid file", [this](const char *arg) {
           m_pid = arg;
           return m_pid != "";
@@ -185,6 +264,16 @@ struct ipxp_conf_t {
    uint32_t worker_cnt;
    uint32_t fps;
    uint32_t max_pkts;
+   uint32_t shards;
+   uint32_t outputs_cnt;
+   bool split;
+   uint32_t analytics_cnt;
+   int numa_node;
+   IdleConfig idle;
+   std::vector<std::vector<unsigned>> input_cpus;
+   std::vector<std::vector<unsigned>> storage_cpus;
+   std::vector<std::vector<unsigned>> output_cpus;
+   std::vector<std::vector<unsigned>> analytics_cpus;
 
    PluginManager mgr;
    struct Plugins {
@@ -196,12 +285,17 @@ struct ipxp_conf_t {
    } active;
 
    std::vector<WorkPipeline> pipelines;
+   std::vector<StorageWorker> storages;
    std::vector<OutputWorker> outputs;
+   std::vector<AnalyticsWorker> analytics;
+   std::vector<Dispatcher *> dispatchers;
 
    std::vector<std::atomic<InputStats> *> input_stats;
    std::vector<std::atomic<OutputStats> *> output_stats;
+   std::vector<SharedCacheStats *> cache_stats;
 
    std::vector<std::shared_future<WorkerResult>> input_fut;
+   std::vector<std::shared_future<WorkerResult>> storage_fut;
    std::vector<std::future<WorkerResult>> output_fut;  
 
    size_t pkt_bufsize;
@@ -215,7 +309,7 @@ struct ipxp_conf_t {
 
    ipxp_conf_t() : iqueue_size(DEFAULT_IQUEUE_SIZE),
                    oqueue_size(DEFAULT_OQUEUE_SIZE),
-                   worker_cnt(0), fps(0), max_pkts(0),
+                   worker_cnt(0), fps(0), max_pkts(0), shards(0), outputs_cnt(1), split(false), analytics_cnt(0), numa_node(-1),
                    pkt_bufsize(1600), blocks_cnt(0), pkts_cnt(0), pkt_data_cnt(0), blocks(nullptr), pkts(nullptr), pkt_data(nullptr)
    {
    }
@@ -232,6 +326,37 @@ struct ipxp_conf_t {
          delete it.input.promise;
       }
 
+      for (auto &it : dispatchers) {
+         it->stop();
+      }
+      for (auto &it : storages) {
+         if (it.thread->joinable()) {
+            it.thread->join();
+         }
+      }
+
+      // Analytics workers call process plugins of storages
+      terminate_analytics = 1;
+      for (auto &it : analytics) {
+         if (it.thread->joinable()) {
+            it.thread->join();
+         }
+         delete it.thread;
+         ipx_ring_destroy(it.queue);
+      }
+
+      for (auto &it : storages) {
+         delete it.thread;
+         delete it.promise;
+         delete it.plugin;
+         for (auto &itp : it.plugins) {
+            delete itp;
+         }
+      }
+      for (auto &it : dispatchers) {
+         delete it;
+      }
+
       for (auto &it : pipelines) {
          delete it.storage.plugin;
       }
@@ -259,6 +384,9 @@ struct ipxp_conf_t {
       for (auto &it : output_stats) {
          delete it;
       }
+      for (auto &it : cache_stats) {
+         delete it;
+      }
    }
 };
 
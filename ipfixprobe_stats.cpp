@@ -166,7 +166,9 @@ int main(int argc, char *argv[])
          std::setw(10) << "parsed" <<
          std::setw(16) << "bytes" <<
          std::setw(10) << "dropped" <<
-         std::setw(10) << "qtime" << std::endl;
+         std::setw(10) << "qtime" <<
+         std::setw(10) << "busy" <<
+         std::setw(10) << "idle" << std::endl;
 
       uint8_t *data = buffer + sizeof(msg_header_t);
       size_t idx = 0;
@@ -179,7 +181,9 @@ int main(int argc, char *argv[])
             std::setw(9) << stats->parsed << " " <<
             std::setw(15) << stats->bytes << " " <<
             std::setw(9) << stats->dropped << " " <<
-            std::setw(9) << stats->qtime << " " << std::endl;
+            std::setw(9) << stats->qtime << " " <<
+            std::setw(9) << stats->busy << " " <<
+            std::setw(9) << stats->idle << " " << std::endl;
       }
 
       std::cout << "Output stats:" << std::endl <<
@@ -187,7 +191,9 @@ int main(int argc, char *argv[])
          std::setw(10) << "biflows" <<
          std::setw(10) << "packets" <<
          std::setw(16) << "bytes" <<
-         std::setw(10) << "dropped" << std::endl;
+         std::setw(10) << "dropped" <<
+         std::setw(10) << "busy" <<
+         std::setw(10) << "idle" << std::endl;
 
       idx = 0;
       for (size_t i = 0; i < hdr->outputs; i++) {
@@ -198,14 +204,20 @@ int main(int argc, char *argv[])
             std::setw(9) << stats->biflows << " " <<
             std::setw(9) << stats->packets << " " <<
             std::setw(15) << stats->bytes << " " <<
-            std::setw(9) << stats->dropped << " " << std::endl;
+            std::setw(9) << stats->dropped << " " <<
+            std::setw(9) << stats->busy << " " <<
+            std::setw(9) << stats->idle << " " << std::endl;
+      }
+
+      lines_written = hdr->inputs + hdr->outputs + 4;
+      if (hdr->caches) {
+         lines_written += print_cache_stats(std::cout, (CacheStats *) data, hdr->caches);
       }
 
       if (parser.m_one) {
          break;
       }
 
-      lines_written = hdr->inputs + hdr->outputs + 4;
       usleep(1000000);
    }
 EXIT:
@@ -59,6 +59,7 @@
 #include <ipfixprobe/flowifc.hpp>
 #include <ipfixprobe/byte-utils.hpp>
 #include <ipfixprobe/ipfix-elements.hpp>
+#include <ipfixprobe/clock.hpp>
 #include "ipfix.hpp"
 
 namespace ipxp {
@@ -131,6 +132,12 @@ const char *basic_tmplt_v6[] = {
    nullptr
 };
 
+/* Sampling fields following basic template of sampled flows. */
+const char *sampling_tmplt[] = {
+   IPFIX_SAMPLING_TEMPLATE(IPFIX_FIELD_NAMES)
+   nullptr
+};
+
 IPFIXExporter::IPFIXExporter() :
    extensions(nullptr), extension_cnt(0),
    templates(nullptr), templatesDataSize(0),
@@ -142,7 +149,7 @@ IPFIXExporter::IPFIXExporter() :
    reconnectTimeout(RECONNECT_TIMEOUT), lastReconnect(0), odid(0),
    templateRefreshTime(TEMPLATE_REFRESH_TIME),
    templateRefreshPackets(TEMPLATE_REFRESH_PACKETS),
-   dir_bit_field(0),
+   dir_bit_field(0), sampling_algorithm(SAMPLING_ALGORITHM_DETERMINISTIC),
    mtu(DEFAULT_MTU), packetDataBuffer(nullptr),
    tmpltMaxBufferSize(mtu - IPFIX_HEADER_SIZE)
 {
@@ -168,7 +175,7 @@ void IPFIXExporter::init(const char *params)
 
    host = parser.m_host;
    port = parser.m_port;
-   odid = parser.m_id;
+   odid = parser.m_id + m_worker_id;
    mtu = parser.m_mtu;
    dir_bit_field = parser.m_dir;
 
@@ -187,7 +194,7 @@ void IPFIXExporter::init(const char *params)
 
    int ret = connect_to_collector();
    if (ret) {
-      lastReconnect = time(nullptr);
+      lastReconnect = CoarseClock::seconds();
    }
 
    if (verbose) {
@@ -269,12 +276,20 @@ uint64_t IPFIXExporter::get_template_id(const Record &flow)
 
 template_t *IPFIXExporter::get_template(const Flow &flow)
 {
-   int ipTmpltIdx = flow.ip_version == IP::v6 ? TMPLT_IDX_V6 : TMPLT_IDX_V4;
+   bool sampled = flow.sampling_interval > 1;
+   int v4TmpltIdx = sampled ? TMPLT_IDX_V4_SAMPLED : TMPLT_IDX_V4;
+   int v6TmpltIdx = sampled ? TMPLT_IDX_V6_SAMPLED : TMPLT_IDX_V6;
+   int ipTmpltIdx = flow.ip_version == IP::v6 ? v6TmpltIdx : v4TmpltIdx;
    uint64_t tmpltIdx = get_template_id(flow);
 
    if (tmpltMap[ipTmpltIdx].find(tmpltIdx) == tmpltMap[ipTmpltIdx].end()) {
       std::vector<const char *> all_fields;
 
+      /* Sampling fields are filled right after basic fields */
+      for (const char **field = sampled ? sampling_tmplt : nullptr; field && *field; field++) {
+         all_fields.push_back(*field);
+      }
+
       RecordExt *ext = flow.m_exts;
       while (ext != nullptr) {
          if (ext->m_ext_id < 0 || ext->m_ext_id >= extension_cnt) {
@@ -299,8 +314,8 @@ template_t *IPFIXExporter::get_template(const Flow &flow)
       }
       all_fields.push_back(nullptr);
 
-      tmpltMap[TMPLT_IDX_V4][tmpltIdx] = create_template(basic_tmplt_v4, all_fields.data());
-      tmpltMap[TMPLT_IDX_V6][tmpltIdx] = create_template(basic_tmplt_v6, all_fields.data());
+      tmpltMap[v4TmpltIdx][tmpltIdx] = create_template(basic_tmplt_v4, all_fields.data());
+      tmpltMap[v6TmpltIdx][tmpltIdx] = create_template(basic_tmplt_v6, all_fields.data());
    }
 
    return tmpltMap[ipTmpltIdx][tmpltIdx];
@@ -420,7 +435,7 @@ int IPFIXExporter::fill_template_set_header(uint8_t *ptr, uint16_t size)
 void IPFIXExporter::check_template_lifetime(template_t *tmpl)
 {
    if (templateRefreshTime != 0 &&
-         (time_t) (templateRefreshTime + tmpl->exportTime) <= time(nullptr)) {
+         (time_t) (templateRefreshTime + tmpl->exportTime) <= CoarseClock::seconds()) {
       if (verbose) {
          fprintf(stderr, "VERBOSE: Template %i refresh time expired (%is)\n", tmpl->id, templateRefreshTime);
       }
@@ -449,7 +464,7 @@ int IPFIXExporter::fill_ipfix_header(uint8_t *ptr, uint16_t size)
 
    header->version = htons(IPFIX_VERISON);
    header->length = htons(size);
-   header->exportTime = htonl(time(nullptr));
+   header->exportTime = htonl(CoarseClock::seconds());
    header->sequenceNumber = htonl(sequenceNum);
    header->observationDomainId = htonl(odid);
 
@@ -492,7 +507,7 @@ void IPFIXExporter::expire_templates()
    for (tmp = templates; tmp != nullptr; tmp = tmp->next) {
       tmp->exported = 0;
       if (protocol == IPPROTO_UDP) {
-         tmp->exportTime = time(nullptr);
+         tmp->exportTime = CoarseClock::seconds();
          tmp->exportPacket = exportedPackets;
       }
    }
@@ -617,7 +632,7 @@ template_t *IPFIXExporter::create_template(const char **tmplt, const char **ext)
 
    /* The template was not exported yet */
    newTemplate->exported = 0;
-   newTemplate->exportTime = time(nullptr);
+   newTemplate->exportTime = CoarseClock::seconds();
    newTemplate->exportPacket = exportedPackets;
 
    /* Add the new template to the list */
@@ -681,7 +696,7 @@ uint16_t IPFIXExporter::create_template_packet(ipfix_packet_t *packet)
          ptr += tmp->templateSize;
          /* Set the templates as exported, store time and serial number */
          tmp->exported = 1;
-         tmp->exportTime = time(nullptr);
+         tmp->exportTime = CoarseClock::seconds();
          tmp->exportPacket = exportedPackets;
       }
       tmp = tmp->next;
@@ -992,7 +1007,7 @@ int IPFIXExporter::reconnect()
    /* Check for broken connection */
    if (lastReconnect != 0) {
       /* Check whether we need to attempt reconnection */
-      if ((time_t) (lastReconnect + reconnectTimeout) <= time(nullptr)) {
+      if ((time_t) (lastReconnect + reconnectTimeout) <= CoarseClock::seconds()) {
          /* Try to reconnect */
          if (connect_to_collector() == 0) {
             lastReconnect = 0;
@@ -1001,7 +1016,7 @@ int IPFIXExporter::reconnect()
             send_templates();
          } else {
             /* Set new reconnect time and drop packet */
-            lastReconnect = time(nullptr);
+            lastReconnect = CoarseClock::seconds();
             return 1;
          }
       } else {
@@ -1026,6 +1041,10 @@ BASIC_TMPLT_V4(GEN_FILLFIELDS_INT) \
 BASIC_TMPLT_V6(GEN_FILLFIELDS_INT) \
 } while (0)
 
+#define GENERATE_FILL_FIELDS_SAMPLING() do { \
+IPFIX_SAMPLING_TEMPLATE(GEN_FILLFIELDS_INT) \
+} while (0)
+
 #define GENERATE_FIELDS_SUMLEN(TMPL) TMPL(GEN_FIELDS_SUMLEN_INT) 0
 
 /**
@@ -1079,6 +1098,20 @@ int IPFIXExporter::fill_basic_flow(const Flow &flow, template_t *tmplt)
 #endif
    }
 
+   if (flow.sampling_interval > 1) {
+      if (tmplt->bufferSize + (p - buffer) + GENERATE_FIELDS_SUMLEN(IPFIX_SAMPLING_TEMPLATE) > tmpltMaxBufferSize) {
+         return -1;
+      }
+#if GCC_CHECK_PRAGMA
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wstrict-aliasing"
+#endif
+      GENERATE_FILL_FIELDS_SAMPLING();
+#if GCC_CHECK_PRAGMA
+# pragma GCC diagnostic pop
+#endif
+   }
+
    length = p - buffer;
 
    return length;
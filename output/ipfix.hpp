@@ -63,6 +63,7 @@
 #define RECONNECT_TIMEOUT 60
 #define TEMPLATE_REFRESH_TIME 600
 #define TEMPLATE_REFRESH_PACKETS 0
+#define SAMPLING_ALGORITHM_DETERMINISTIC 1
 
 namespace ipxp {
 
@@ -88,7 +89,7 @@ public:
          [this](const char *arg){try {m_mtu = str2num<decltype(m_mtu)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
          OptionFlags::RequiredArgument);
       register_option("u", "udp", "", "Use UDP protocol", [this](const char *arg){m_udp = true; return true;}, OptionFlags::NoArgument);
-      register_option("I", "id", "NUM", "Exporter identification",
+      register_option("I", "id", "NUM", "Exporter identification, output worker N uses NUM+N as ODID",
          [this](const char *arg){try {m_id = str2num<decltype(m_id)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
          OptionFlags::RequiredArgument);
       register_option("d", "dir", "NUM", "Dir bit field value",
@@ -241,6 +242,8 @@ private:
    enum TmpltMapIdx {
       TMPLT_IDX_V4 = 0,
       TMPLT_IDX_V6 = 1,
+      TMPLT_IDX_V4_SAMPLED = 2,
+      TMPLT_IDX_V6_SAMPLED = 3,
       TMPLT_MAP_IDX_CNT
    };
    RecordExt **extensions;
@@ -269,6 +272,7 @@ private:
    uint32_t templateRefreshTime; /**< UDP template refresh time interval */
    uint32_t templateRefreshPackets; /**< UDP template refresh packet interval */
    uint32_t dir_bit_field;     /**< Direction bit field value. */
+   uint8_t sampling_algorithm; /**< Sampling algorithm value of sampled flows. */
 
    uint16_t mtu; /**< Max size of packet payload sent */
    uint8_t *packetDataBuffer; /**< Data buffer to store packet */
@@ -59,6 +59,8 @@ __attribute__((constructor)) static void register_this_plugin()
    register_plugin(&rec);
 }
 
+std::mutex TextExporter::m_stdout_lock;
+
 TextExporter::TextExporter() : m_out(&std::cout), m_hide_mac(false)
 {
 }
@@ -78,7 +80,11 @@ void TextExporter::init(const char *params)
    }
 
    if (parser.m_to_file) {
-      std::ofstream *file = new std::ofstream(parser.m_file, std::ofstream::out);
+      std::string path = parser.m_file;
+      if (m_worker_cnt > 1) {
+         path += "." + std::to_string(m_worker_id);
+      }
+      std::ofstream *file = new std::ofstream(path, std::ofstream::out);
       if (file->fail()) {
          throw PluginError("failed to open output file");
       }
@@ -86,6 +92,10 @@ void TextExporter::init(const char *params)
    }
    m_hide_mac = parser.m_hide_mac;
 
+   if (m_out == &std::cout && m_worker_id != 0) {
+      // Header is printed only once to shared stdout
+      return;
+   }
    if (!m_hide_mac) {
       *m_out << "mac ";
    }
@@ -108,7 +118,11 @@ void TextExporter::close()
 int TextExporter::export_flow(const Flow &flow)
 {
    RecordExt *ext = flow.m_exts;
+   std::unique_lock<std::mutex> lock(m_stdout_lock, std::defer_lock);
 
+   if (m_out == &std::cout && m_worker_cnt > 1) {
+      lock.lock();
+   }
    m_flows_seen++;
    print_basic_flow(flow);
    while (ext != nullptr) {
@@ -47,6 +47,7 @@
 #include <config.h>
 
 #include <string>
+#include <mutex>
 
 #include <ipfixprobe/output.hpp>
 #include <ipfixprobe/process.hpp>
@@ -66,7 +67,7 @@ public:
    TextOptParser() : OptionsParser("text", "Output plugin for text export"),
       m_file(""), m_to_file(false), m_hide_mac(false)
    {
-      register_option("f", "file", "PATH", "Print output to file",
+      register_option("f", "file", "PATH", "Print output to file, suffixed with .N for output worker N when using more workers",
          [this](const char *arg){m_file = arg; m_to_file = true; return true;}, OptionFlags::RequiredArgument);
       register_option("m", "mac", "", "Hide mac addresses",
          [this](const char *arg){m_hide_mac = true; return true;}, OptionFlags::NoArgument);
@@ -89,6 +90,8 @@ private:
    std::ostream *m_out;
    bool m_hide_mac;
 
+   static std::mutex m_stdout_lock; /**< Serializes records of output workers sharing stdout. */
+
    void print_basic_flow(const Flow &flow);
 };
 
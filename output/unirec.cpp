@@ -179,6 +179,9 @@ void UnirecExporter::init(const char *params)
    if (parser.m_ifc.empty()) {
       throw PluginError("specify libtrap interface specifier");
    }
+   if (m_worker_cnt > 1) {
+      throw PluginError("libtrap interfaces cannot be shared by multiple output workers");
+   }
    m_odid = parser.m_odid;
    m_eof = parser.m_eof;
    m_link_bit_field = parser.m_id;
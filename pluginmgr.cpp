@@ -42,6 +42,9 @@
  */
 
 #include <dlfcn.h>
+#include <vector>
+
+#include <ipfixprobe/flowifc.hpp>
 
 #include "pluginmgr.hpp"
 
@@ -59,8 +62,24 @@ void register_plugin(PluginRecord *rec)
    *tmp = rec;
 }
 
+/**
+ * \brief Get factories of extensions indexed by extension ID. Extensions are registered by constructors
+ * of plugin libraries, so the array is created on the first use.
+ */
+static std::vector<RecordExtFactory> &ext_factories()
+{
+   static std::vector<RecordExtFactory> factories;
+   return factories;
+}
+
 int register_extension()
 {
+   return register_extension(nullptr);
+}
+
+int register_extension(RecordExtFactory factory)
+{
+   ext_factories().push_back(factory);
    return ipxp_ext_cnt++;
 }
 
@@ -69,6 +88,19 @@ int get_extension_cnt()
    return ipxp_ext_cnt;
 }
 
+/**
+ * \brief Create empty extension of given ID.
+ * \return New extension or nullptr when the extension was registered without a factory.
+ */
+RecordExt *create_extension(int id)
+{
+   const std::vector<RecordExtFactory> &factories = ext_factories();
+   if (id < 0 || static_cast<size_t>(id) >= factories.size() || factories[id] == nullptr) {
+      return nullptr;
+   }
+   return factories[id]();
+}
+
 PluginManager::PluginManager() : m_last_rec(nullptr)
 {
    register_loaded_plugins();
@@ -53,7 +53,7 @@ __attribute__((constructor)) static void register_this_plugin()
 {
    static PluginRecord rec = PluginRecord("basicplus", [](){return new BASICPLUSPlugin();});
    register_plugin(&rec);
-   RecordExtBASICPLUS::REGISTERED_ID = register_extension();
+   RecordExtBASICPLUS::REGISTERED_ID = register_extension([]() -> RecordExt * {return new RecordExtBASICPLUS();});
 }
 
 BASICPLUSPlugin::BASICPLUSPlugin()
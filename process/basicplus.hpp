@@ -45,6 +45,7 @@
 #define IPXP_PROCESS_BASICPLUS_HPP
 
 #include <string>
+#include <cstring>
 #include <sstream>
 
 #ifdef WITH_NEMEA
@@ -151,6 +152,44 @@ struct RecordExtBASICPLUS : public RecordExt {
       return 34;
    }
 
+   int save(uint8_t *buffer, size_t size) const
+   {
+      if (size < 35) {
+         return -1;
+      }
+
+      buffer[0] = ip_ttl[0];
+      buffer[1] = ip_ttl[1];
+      buffer[2] = ip_flg[0];
+      buffer[3] = ip_flg[1];
+      memcpy(buffer + 4, tcp_win, sizeof(tcp_win));
+      memcpy(buffer + 8, tcp_opt, sizeof(tcp_opt));
+      memcpy(buffer + 24, tcp_mss, sizeof(tcp_mss));
+      memcpy(buffer + 32, &tcp_syn_size, sizeof(tcp_syn_size));
+      buffer[34] = dst_filled;
+
+      return 35;
+   }
+
+   bool load(const uint8_t *buffer, size_t size)
+   {
+      if (size != 35) {
+         return false;
+      }
+
+      ip_ttl[0] = buffer[0];
+      ip_ttl[1] = buffer[1];
+      ip_flg[0] = buffer[2];
+      ip_flg[1] = buffer[3];
+      memcpy(tcp_win, buffer + 4, sizeof(tcp_win));
+      memcpy(tcp_opt, buffer + 8, sizeof(tcp_opt));
+      memcpy(tcp_mss, buffer + 24, sizeof(tcp_mss));
+      memcpy(&tcp_syn_size, buffer + 32, sizeof(tcp_syn_size));
+      dst_filled = buffer[34] != 0;
+
+      return true;
+   }
+
    const char **get_ipfix_tmplt() const
    {
       static const char *ipfix_tmplt[] = {
@@ -59,7 +59,7 @@ __attribute__((constructor)) static void register_this_plugin()
 {
    static PluginRecord rec = PluginRecord("pstats", [](){return new PSTATSPlugin();});
    register_plugin(&rec);
-   RecordExtPSTATS::REGISTERED_ID = register_extension();
+   RecordExtPSTATS::REGISTERED_ID = register_extension([]() -> RecordExt * {return new RecordExtPSTATS();});
 }
 
 //#define DEBUG_PSTATS
@@ -175,6 +175,75 @@ struct RecordExtPSTATS : public RecordExt {
       return bufferPtr;
    } // fill_ipfix
 
+   /**
+    * \brief Get size of data written by save.
+    */
+   size_t saved_size() const
+   {
+      return sizeof(pkt_count) + pkt_count * (sizeof(*pkt_sizes) + sizeof(*pkt_tcp_flgs) + sizeof(*pkt_timestamps) + sizeof(*pkt_dirs)) +
+         sizeof(tcp_seq) + sizeof(tcp_ack) + sizeof(tcp_len) + sizeof(tcp_flg);
+   }
+
+   int save(uint8_t *buffer, size_t size) const
+   {
+      size_t req_size = saved_size();
+      if (req_size > size) {
+         return -1;
+      }
+
+      uint8_t *pos = buffer;
+      memcpy(pos, &pkt_count, sizeof(pkt_count));
+      pos += sizeof(pkt_count);
+      memcpy(pos, pkt_sizes, pkt_count * sizeof(*pkt_sizes));
+      pos += pkt_count * sizeof(*pkt_sizes);
+      memcpy(pos, pkt_tcp_flgs, pkt_count * sizeof(*pkt_tcp_flgs));
+      pos += pkt_count * sizeof(*pkt_tcp_flgs);
+      memcpy(pos, pkt_timestamps, pkt_count * sizeof(*pkt_timestamps));
+      pos += pkt_count * sizeof(*pkt_timestamps);
+      memcpy(pos, pkt_dirs, pkt_count * sizeof(*pkt_dirs));
+      pos += pkt_count * sizeof(*pkt_dirs);
+      memcpy(pos, tcp_seq, sizeof(tcp_seq));
+      pos += sizeof(tcp_seq);
+      memcpy(pos, tcp_ack, sizeof(tcp_ack));
+      pos += sizeof(tcp_ack);
+      memcpy(pos, tcp_len, sizeof(tcp_len));
+      pos += sizeof(tcp_len);
+      memcpy(pos, tcp_flg, sizeof(tcp_flg));
+
+      return req_size;
+   }
+
+   bool load(const uint8_t *buffer, size_t size)
+   {
+      if (size < sizeof(pkt_count)) {
+         return false;
+      }
+      memcpy(&pkt_count, buffer, sizeof(pkt_count));
+      if (pkt_count > PSTATS_MAXELEMCOUNT || saved_size() != size) {
+         pkt_count = 0;
+         return false;
+      }
+
+      const uint8_t *pos = buffer + sizeof(pkt_count);
+      memcpy(pkt_sizes, pos, pkt_count * sizeof(*pkt_sizes));
+      pos += pkt_count * sizeof(*pkt_sizes);
+      memcpy(pkt_tcp_flgs, pos, pkt_count * sizeof(*pkt_tcp_flgs));
+      pos += pkt_count * sizeof(*pkt_tcp_flgs);
+      memcpy(pkt_timestamps, pos, pkt_count * sizeof(*pkt_timestamps));
+      pos += pkt_count * sizeof(*pkt_timestamps);
+      memcpy(pkt_dirs, pos, pkt_count * sizeof(*pkt_dirs));
+      pos += pkt_count * sizeof(*pkt_dirs);
+      memcpy(tcp_seq, pos, sizeof(tcp_seq));
+      pos += sizeof(tcp_seq);
+      memcpy(tcp_ack, pos, sizeof(tcp_ack));
+      pos += sizeof(tcp_ack);
+      memcpy(tcp_len, pos, sizeof(tcp_len));
+      pos += sizeof(tcp_len);
+      memcpy(tcp_flg, pos, sizeof(tcp_flg));
+
+      return true;
+   }
+
    const char **get_ipfix_tmplt() const
    {
       static const char *ipfix_tmplt[] = {
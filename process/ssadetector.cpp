@@ -211,6 +211,21 @@ void SSADetectorPlugin::pre_export(Flow& rec)
    record->possible_vpn = 1;
 }
 
+bool SSADetectorPlugin::defer_export(const Flow& rec) const
+{
+   // only flows which need classes_ratio are worth deferring
+   uint32_t packets = rec.src_packets + rec.dst_packets;
+   if (packets <= MIN_PKT_IN_FLOW) {
+      return false;
+   }
+   RecordExtSSADetector* record
+       = (RecordExtSSADetector*) rec.get_extension(RecordExtSSADetector::REGISTERED_ID);
+   if (record == nullptr || record->suspects < MIN_NUM_SUSPECTS) {
+      return false;
+   }
+   return double(packets) / double(record->suspects) <= MIN_SUSPECTS_RATIO;
+}
+
 //--------------------RecordExtSSADetector::pkt_entry-------------------------------
 void RecordExtSSADetector::pkt_entry::reset()
 {
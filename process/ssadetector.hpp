@@ -192,6 +192,7 @@ class SSADetectorPlugin : public ProcessPlugin {
    int post_create(Flow& rec, const Packet& pkt);
    int post_update(Flow& rec, const Packet& pkt);
    void pre_export(Flow& rec);
+   bool defer_export(const Flow& rec) const;
    void update_record(RecordExtSSADetector* record, const Packet& pkt);
    static inline void
    transition_from_init(RecordExtSSADetector* record, uint16_t len, const timeval& ts, uint8_t dir);
@@ -42,10 +42,14 @@
  */
 
 #include <iostream>
+#include <mutex>
 #include "timeseries.hpp"
 
 namespace ipxp {
 
+// FFTW planner used by NFFT is not thread safe, results are computed by several threads
+static std::mutex nfft_plan_lock;
+
     std::vector<std::pair<uint16_t, uint16_t>> PacketLengthsArray::getHistogram() const{
         uint16_t Hist[1501] = {0};
         for (size_t i = 0; i < m_packet_lengths.size(); i++){
@@ -273,7 +277,10 @@ void RecordExtTIMESERIES::nfft(const double *t, const double *y,
     // coefficients (positive and negative
     // frequencies ) and n data samples.
     nfft_plan p;
-    nfft_init_1d(&p, 2 * m, n);
+    {
+        std::lock_guard<std::mutex> guard(nfft_plan_lock);
+        nfft_init_1d(&p, 2 * m, n);
+    }
 
     if (y != NULL) // data spectrum
     {
@@ -311,7 +318,10 @@ void RecordExtTIMESERIES::nfft(const double *t, const double *y,
 
     // d[m] = conj(p.f_hat[0]);
 
-    nfft_finalize(&p);
+    {
+        std::lock_guard<std::mutex> guard(nfft_plan_lock);
+        nfft_finalize(&p);
+    }
 
 }
 
@@ -1121,4 +1131,9 @@ RecordExtTIMESERIES *r = (RecordExtTIMESERIES *) rec.get_extension(RecordExtTIME
     r->calculateResult();
 }
 
+bool TIMESERIESPlugin::defer_export(const Flow &rec) const
+{
+    return rec.get_extension(RecordExtTIMESERIES::REGISTERED_ID) != nullptr;
+}
+
 }
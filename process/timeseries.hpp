@@ -822,6 +822,7 @@ public:
    int post_create(Flow &rec, const Packet &pkt);
    int pre_update(Flow &rec, Packet &pkt);
    void pre_export(Flow &rec);
+   bool defer_export(const Flow &rec) const;
 
 private:
     bool Statistics,Time,Behavior,Frequency;
@@ -40,10 +40,15 @@
  */
 
 #define _ISOC11_SOURCE
+#define _GNU_SOURCE
 #include <stdlib.h> // aligned_malloc
-//#include <unistd.h>
-#include <pthread.h>
+#include <unistd.h>
 #include <time.h>
+#include <sched.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/eventfd.h>
+#endif
 
 #include <ipfixprobe/ring.h>
 
@@ -71,116 +76,62 @@
 #define __ipx_cache_aligned __ipx_aligned(IPX_CLINE_SIZE)
 // END
 
+/** Time a reader waits for messages before ipx_ring_pop() gives up (milliseconds) */
+#define RING_READER_WAIT 10
+/** Longest sleep of a writer waiting for free space (microseconds) */
+#define RING_WRITER_SLEEP_MAX 1000
+/** Default number of empty checks before a reader goes to sleep */
+#define RING_READER_SPIN 64
+
 /** Internal identification of the ring buffer */
 static const char *module = "Ring buffer";
 
-/** \brief Data structure for a reader only */
-struct ring_reader {
-    /**
-     * \brief Reader head in the buffer (start of the next read operation)
-     * \note Value range [0..size - 1]. Must NOT point behind the end of the buffer.
-     */
-    uint32_t data_idx;
-    /**
-     * \brief Reader head (start of the next read operation)
-     * \warning Not limited by the buffer's boundary. Overflow is expected behavior.
-     * \note Value range [0..UINT32_MAX].
-     */
-    uint32_t read_idx;
-    /**
-     * \brief Last known index of writer head (start of the data that still belongs to a writer)
-     * \note In other words, a reader can read up to here (exclusive!).
-     * \note Value range [0..UINT32_MAX].
-     */
-    uint32_t exchange_idx;
-    /**
-     * \brief Reader index of the last sync with a writer (update of the sync structure)
-     * \note Value range [0..UINT32_MAX]. Based on #read_idx.
-     */
-    uint32_t read_commit_idx;
-    /** \brief Total size of the ring buffer (number of pointers)                    */
-    uint32_t size;
-    /**
-     * \brief Size of a synchronization block
-     * \note After writing at least this amount of data, update synchronization structure.
-     */
-    uint32_t div_block;
-
-    /** Previously read messages - only 0 or 1 */
-    uint32_t last;
+/**
+ * \brief Slot of the ring buffer
+ *
+ * Sequence number of a slot tells which position may use it. The slot is free for a writer of
+ * position P when the sequence is P and it holds a message for the reader when the sequence is
+ * P + 1. Reader frees the slot for position P + size. Every slot is therefore synchronized on its
+ * own and neither writers nor the reader need a lock.
+ */
+struct ring_slot {
+    /** Sequence number of the slot */
+    uint32_t   seq;
+    /** Message                     */
+    ipx_msg_t *msg;
 };
 
-/** \brief Data structure for writers only */
-struct ring_writer {
-    /**
-     * \brief Writer head in the buffer (start of the next write operation)
-     * \note Value range [0..size - 1]. Must NOT point behind the end of the buffer.
-     */
-    uint32_t data_idx;
+/** \brief Ring buffer */
+struct ipx_ring {
     /**
-     * \brief Writer head (start of the next write operation)
-     * \warning This value can be read by a reader! Therefore, modification MUST be always atomic.
+     * \brief Writer head (next position to reserve)
      * \warning Not limited by the buffer's boundary. Overflow is expected behavior.
-     * \note Value range [0..UINT32_MAX].
-     */
-    uint32_t write_idx;
-    /**
-     * \brief Last known index of reader head (start of the data that still belongs to a reader)
-     * \note In other words, a writer can write up to here (exclusive!).
-     * \note Value range [0..UINT32_MAX].
-     */
-    uint32_t exchange_idx;
-    /**
-     * \brief Writer index of the last sync with a reader (update of the sync structure)
-     * \note Value range [0..UINT32_MAX]. Based on #write_idx.
-     */
-    uint32_t write_commit_idx;
-    /** \brief Total size of the ring buffer (number of pointers)                    */
-    uint32_t size;
-    /**
-     * \brief Size of a synchronization block
-     * \note After writing at least this amount of data, update synchronization structure.
-     */
-    uint32_t div_block;
-};
-
-/** \brief Exchange data structure for reader and writers */
-struct ring_sync {
-    /**
-     * \brief Reader head
-     * \note End of data read by a reader, i.e. a writer can write up to here (exclusive!).
-     * \note Value range [0..UINT32_MAX].
      */
-    uint32_t           write_idx;
+    uint32_t          write_idx   __ipx_cache_aligned;
+    /** \brief Reader head (next position to read)                                          */
+    uint32_t          read_idx    __ipx_cache_aligned;
     /**
-     * \brief Writer head
-     * \note End of data written by a writer, i.e. a reader can read up to here (exclusive!).
-     * \note Value range [0..UINT32_MAX].
+     * \brief End of messages processed by the reader
+     * \note Messages returned by a pop are considered processed by the next pop, other threads
+     *   read it to count messages that are not processed yet.
      */
-    uint32_t           read_idx;
-    /** \brief Synchronization mutex (MUST be always used to access data structures here)    */
-    pthread_mutex_t    mutex;
-
-    /** \brief Reader condition variable (empty buffer) */
-    pthread_cond_t     cond_reader;
-    /** \brief Writer condition variable (full buffer)  */
-    pthread_cond_t     cond_writer;
-};
-
-/** \brief Ring buffer */
-struct ipx_ring {
-    /** A Reader only structure (cache aligned)         */
-    struct ring_reader reader      __ipx_cache_aligned;
-    /** Writers only structure (cache aligned)          */
-    struct ring_writer writer      __ipx_cache_aligned;
-    /** Writer lock                                     */
-    pthread_spinlock_t writer_lock __ipx_cache_aligned;
-    /** Synchronization structure (cache-aligned)       */
-    struct ring_sync   sync        __ipx_cache_aligned;
-    /** Multiple writers mode                           */
-    bool               mw_mode;
-    /** Ring data (array of pointers)                   */
-    ipx_msg_t        **data;
+    uint32_t          done_idx;
+    /** Reader is going to sleep and wants to be woken up by the next writer  */
+    uint32_t          waiting     __ipx_cache_aligned;
+    /** Event descriptor signaled when the reader should wake up, -1 when not available */
+    int               event_fd;
+    /** Total size of the ring buffer (number of slots, power of two) */
+    uint32_t          size;
+    /** Mask of slot index */
+    uint32_t          mask;
+    /** Multiple writers mode */
+    bool              mw_mode;
+    /** Empty checks of the reader before it starts yielding */
+    uint32_t          reader_spin;
+    /** Empty checks of the reader with yielding before it goes to sleep */
+    uint32_t          reader_yield;
+    /** Ring data (array of slots) */
+    struct ring_slot *data;
 };
 
 ipx_ring_t *
@@ -188,6 +139,11 @@ ipx_ring_init(uint32_t size, bool mw_mode)
 {
     ipx_ring_t *ring;
 
+    if (size == 0 || size > (UINT32_C(1) << 30)) {
+        IPX_ERROR(module, "invalid size %" PRIu32 "! (%s:%d)", size, __FILE__, __LINE__);
+        return NULL;
+    }
+
     // Prepare data structures
     ring = aligned_alloc(alignof(struct ipx_ring), sizeof(struct ipx_ring));
     if (!ring) {
@@ -195,271 +151,275 @@ ipx_ring_init(uint32_t size, bool mw_mode)
         return NULL;
     }
 
-    ring->data = aligned_alloc(alignof(*ring->data), sizeof(*ring->data) * size);
-    if (!ring->data) {
-        IPX_ERROR(module, "aligned_alloc() failed! (%s:%d)", __FILE__, __LINE__);
-        goto exit_A;
-    }
-
-    // Initialize writers' spin lock
-    int rc;
-    if ((rc = pthread_spin_init(&ring->writer_lock, PTHREAD_PROCESS_PRIVATE)) != 0) {
-        IPX_ERROR(module, "pthread_spin_init() failed! (%s:%d, err: %d)", __FILE__, __LINE__, rc);
-        goto exit_B;
-    }
-
-    // Initialize sync mutex and conditional variables
-    if ((rc = pthread_mutex_init(&ring->sync.mutex, NULL)) != 0) {
-        IPX_ERROR(module, "pthread_mutex_init() failed! (%s:%d, err: %d)", __FILE__, __LINE__, rc);
-        goto exit_C;
-    }
-
-    pthread_condattr_t cond_attr;
-    if ((rc = pthread_condattr_init(&cond_attr)) != 0) {
-        IPX_ERROR(module, "pthread_condattr_init() failed! (%s:%d, err: %d)", __FILE__, __LINE__,
-            rc);
-        goto exit_D;
+    // Positions are mapped to slots by a mask, round size up to a power of two
+    uint32_t slots = 1;
+    while (slots < size) {
+        slots <<= 1;
     }
 
-    if ((rc = pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC)) != 0) {
-        IPX_ERROR(module, "pthread_condattr_setclock() failed! (%s:%d, err: %d)", __FILE__,
-            __LINE__, rc);
-        goto exit_E;
+    ring->data = aligned_alloc(IPX_CLINE_SIZE, sizeof(*ring->data) * slots);
+    if (!ring->data) {
+        IPX_ERROR(module, "aligned_alloc() failed! (%s:%d)", __FILE__, __LINE__);
+        free(ring);
+        return NULL;
     }
-
-    if ((rc = pthread_cond_init(&ring->sync.cond_reader, &cond_attr)) != 0) {
-        IPX_ERROR(module, "pthread_cond_init() failed! (%s:%d, err: %d)", __FILE__, __LINE__, rc);
-        goto exit_E;
+    for (uint32_t i = 0; i < slots; i++) {
+        ring->data[i].seq = i;
+        ring->data[i].msg = NULL;
     }
 
-    if ((rc = pthread_cond_init(&ring->sync.cond_writer, &cond_attr)) != 0) {
-        IPX_ERROR(module, "pthread_cond_init() failed! (%s:%d, err: %d)", __FILE__, __LINE__, rc);
-        goto exit_F;
+#ifdef __linux__
+    // Wakeups are optional, without the descriptor the reader only sleeps for short periods
+    ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->event_fd < 0) {
+        IPX_WARNING(module, "eventfd() failed, reader will poll! (%s:%d)", __FILE__, __LINE__);
     }
-    pthread_condattr_destroy(&cond_attr);
-
-    // Initialize ring variables
-    ring->reader.size = size;
-    ring->reader.div_block = size / 8;
-    ring->reader.data_idx = 0;
-    ring->reader.read_idx = 0;
-    ring->reader.exchange_idx = 0;
-    ring->reader.read_commit_idx = 0;
-    ring->reader.last = 0;
-
-    ring->writer.size = size;
-    ring->writer.div_block = size / 8;
-    ring->writer.data_idx = 0;
-    ring->writer.exchange_idx = size; // Amount of empty memory
-    ring->writer.write_idx = 0;
-    ring->writer.write_commit_idx = 0;
-
-    ring->sync.read_idx = 0;
-    ring->sync.write_idx = size;
+#else
+    ring->event_fd = -1;
+#endif
 
+    ring->write_idx = 0;
+    ring->read_idx = 0;
+    ring->done_idx = 0;
+    ring->waiting = 0;
+    ring->size = slots;
+    ring->mask = slots - 1;
     ring->mw_mode = mw_mode;
+    ring->reader_spin = RING_READER_SPIN;
+    ring->reader_yield = 0;
     return ring;
-
-    // In case failure
-exit_F:
-    pthread_cond_destroy(&ring->sync.cond_reader);
-exit_E:
-    pthread_condattr_destroy(&cond_attr);
-exit_D:
-    pthread_mutex_destroy(&ring->sync.mutex);
-exit_C:
-    pthread_spin_destroy(&ring->writer_lock);
-exit_B:
-    free(ring->data);
-exit_A:
-    free(ring);
-    return NULL;
 }
 
 void
 ipx_ring_destroy(ipx_ring_t *ring)
 {
-    // The last read message is not confirmed by the reader, it is 1 index behind -> "+ 1"
-    if (ring->reader.read_idx != ring->writer.write_idx) {
-        uint32_t cnt = ring->writer.write_idx - ring->reader.read_idx;
+    if (ring->done_idx != ring->write_idx) {
+        uint32_t cnt = ring->write_idx - ring->done_idx;
         IPX_WARNING(module, "Destroying of a ring buffer that still contains %" PRIu32
             " unprocessed message(s)!", cnt);
     }
 
-    pthread_cond_destroy(&ring->sync.cond_writer);
-    pthread_cond_destroy(&ring->sync.cond_reader);
-    pthread_mutex_destroy(&ring->sync.mutex);
-    pthread_spin_destroy(&ring->writer_lock);
+    if (ring->event_fd >= 0) {
+        close(ring->event_fd);
+    }
     free(ring->data);
     free(ring);
 }
 
 /**
- * \brief Wrapper around condition wait
- * \param[in] cond  Condition variable
- * \param[in] mutex Locked mutex
- * \param[in] msec  Number of milliseconds to wait
- * \return Same as the function pthread_cond_timedwait
+ * \brief Check whether the slot of given position is free for a writer
+ * \param[in] ring Ring buffer
+ * \param[in] pos  Position
+ * \return 0 when the slot is free, negative value when it still holds a message of the previous
+ *   round, positive value when the position was already reserved by another writer
  */
-static inline int
-ring_cond_timedwait(pthread_cond_t *__restrict__ cond, pthread_mutex_t *__restrict__ mutex, long msec)
+static inline int32_t
+ring_slot_state(const ipx_ring_t *ring, uint32_t pos)
 {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    ts.tv_nsec += msec * 1000000;
-    if (ts.tv_nsec >= 1000000000) {
-        ts.tv_nsec %= 1000000000;
-        ts.tv_sec += 1;
-    }
-
-    return pthread_cond_timedwait(cond, mutex, &ts);
+    uint32_t seq = __atomic_load_n(&ring->data[pos & ring->mask].seq, __ATOMIC_ACQUIRE);
+    return (int32_t) (seq - pos);
 }
 
 /**
- * \brief Get a new empty field
+ * \brief Reserve up to \p cnt consecutive positions for writing
  *
- * \note The function blocks until a required memory is ready. Before the next call of this
- *   function, the function ipx_ring_commit() MUST be called first, to commit performed
- *   modifications.
- * \param[in] ring Ring buffer
- * \return Pointer to a unused place in the buffer
+ * The reader frees slots in order, so all the positions are free when the last one is.
+ * \param[in]  ring Ring buffer
+ * \param[in]  cnt  Number of positions wanted
+ * \param[out] pos  First reserved position
+ * \return Number of reserved positions, 0 when the buffer is full
  */
-static inline ipx_msg_t **
-ipx_ring_begin(ipx_ring_t *ring)
+static inline uint32_t
+ring_reserve(ipx_ring_t *ring, uint32_t cnt, uint32_t *pos)
 {
-    // Prepare the next pointer to write
-    ipx_msg_t **msg = &ring->data[ring->writer.data_idx];
-
-    // Is there enough space?
-    if (ring->writer.exchange_idx - ring->writer.write_idx > 0) {
-        return msg;
-    }
+    uint32_t head = __atomic_load_n(&ring->write_idx, __ATOMIC_RELAXED);
+    while (1) {
+        uint32_t n = cnt;
+        int32_t state;
+        while ((state = ring_slot_state(ring, head + n - 1)) < 0 && n > 1) {
+            n = (n + 1) / 2;
+        }
+        if (state < 0) {
+            return 0;
+        }
+        if (state > 0) {
+            // Another writer reserved the position in between
+            head = __atomic_load_n(&ring->write_idx, __ATOMIC_RELAXED);
+            continue;
+        }
 
-    // Get an empty space -> reader-writer synchronization
-    pthread_mutex_lock(&ring->sync.mutex);
-    ring->writer.exchange_idx = ring->sync.write_idx;
-    while (ring->writer.exchange_idx - ring->writer.write_idx == 0) {
-        // After sync the buffer is still full, try again later
-        pthread_cond_signal(&ring->sync.cond_reader);
-        ring_cond_timedwait(&ring->sync.cond_writer, &ring->sync.mutex, 10);
-        ring->writer.exchange_idx = ring->sync.write_idx;
+        if (!ring->mw_mode) {
+            __atomic_store_n(&ring->write_idx, head + n, __ATOMIC_RELAXED);
+            *pos = head;
+            return n;
+        }
+        if (__atomic_compare_exchange_n(&ring->write_idx, &head, head + n, true,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            *pos = head;
+            return n;
+        }
     }
-    pthread_cond_signal(&ring->sync.cond_reader);
-    pthread_mutex_unlock(&ring->sync.mutex);
-
-    assert(ring->writer.exchange_idx - ring->writer.write_idx > 0);
-    return msg;
 }
 
 /**
- * \brief Commit modifications of memory
+ * \brief Wake up the reader if it is going to sleep
  * \param[in] ring Ring buffer
  */
 static inline void
-ipx_ring_commit(ipx_ring_t *ring)
+ring_wakeup(ipx_ring_t *ring)
 {
-    register uint32_t new_idx = 1;
-    ring->writer.data_idx++;
-
-    if (ring->writer.size == ring->writer.data_idx) {
-        // End of the ring buffer has been reached -> skip to the beginning
-        ring->writer.data_idx = 0;
+    // Pairs with the fence of the reader, either the reader sees the messages or the writer the flag
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED) &&
+            __atomic_exchange_n(&ring->waiting, 0, __ATOMIC_RELAXED) && ring->event_fd >= 0) {
+#ifdef __linux__
+        eventfd_write(ring->event_fd, 1);
+#endif
     }
+}
 
-    // Atomic update of writer index (Note: new_idx will be the same as writer.write_idx)
-    new_idx += __sync_fetch_and_add(&ring->writer.write_idx, new_idx);
-
-    // Sync positions with a reader, if necessary
-    if (new_idx - ring->writer.write_commit_idx >= ring->writer.div_block) {
-        pthread_mutex_lock(&ring->sync.mutex);
-        ring->sync.read_idx = new_idx;
-        ring->writer.exchange_idx = ring->sync.write_idx;
-        ring->writer.write_commit_idx = new_idx;
-        pthread_cond_signal(&ring->sync.cond_reader);
-        pthread_mutex_unlock(&ring->sync.mutex);
+/**
+ * \brief Wait for a reader to free some slots
+ * \param[in] sleep Current sleep time (microseconds), doubled on every call
+ */
+static inline void
+ring_writer_wait(long *sleep)
+{
+    if (*sleep == 0) {
+        sched_yield();
+        *sleep = 1;
+        return;
+    }
+    struct timespec ts = {0, *sleep * 1000L};
+    nanosleep(&ts, NULL);
+    if (*sleep < RING_WRITER_SLEEP_MAX) {
+        *sleep *= 2;
     }
 }
 
 void
-ipx_ring_push(ipx_ring_t *ring, ipx_msg_t *msg)
+ipx_ring_push_burst(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t cnt)
 {
-    ipx_msg_t **msg_space;
+    long sleep = 0;
+    while (cnt > 0) {
+        uint32_t pos;
+        uint32_t n = ring_reserve(ring, cnt, &pos);
+        if (n == 0) {
+            ring_writer_wait(&sleep);
+            continue;
+        }
+        sleep = 0;
 
-    if (ring->mw_mode) {
-        pthread_spin_lock(&ring->writer_lock);
+        for (uint32_t i = 0; i < n; i++) {
+            struct ring_slot *slot = &ring->data[(pos + i) & ring->mask];
+            slot->msg = msgs[i];
+            __atomic_store_n(&slot->seq, pos + i + 1, __ATOMIC_RELEASE);
+        }
+        ring_wakeup(ring);
+        msgs += n;
+        cnt -= n;
     }
+}
 
-    msg_space = ipx_ring_begin(ring);
-    *msg_space = msg;
-    ipx_ring_commit(ring);
+void
+ipx_ring_push(ipx_ring_t *ring, ipx_msg_t *msg)
+{
+    ipx_ring_push_burst(ring, &msg, 1);
+}
 
-    if (ring->mw_mode) {
-        pthread_spin_unlock(&ring->writer_lock);
+/**
+ * \brief Take ready messages without waiting
+ * \param[in]  ring Ring buffer
+ * \param[out] msgs Array for messages
+ * \param[in]  max  Size of the array
+ * \return Number of messages
+ */
+static inline uint32_t
+ring_take(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t max)
+{
+    uint32_t pos = ring->read_idx;
+    uint32_t cnt = 0;
+    while (cnt < max) {
+        struct ring_slot *slot = &ring->data[pos & ring->mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+            break;
+        }
+        msgs[cnt++] = slot->msg;
+        __atomic_store_n(&slot->seq, pos + ring->size, __ATOMIC_RELEASE);
+        pos++;
     }
+    ring->read_idx = pos;
+    return cnt;
 }
 
-
-ipx_msg_t *
-ipx_ring_pop(ipx_ring_t *ring)
+/**
+ * \brief Sleep until a writer signals new messages or the timeout elapses
+ * \param[in] ring Ring buffer
+ * \param[in] msec Timeout (milliseconds)
+ */
+static void
+ring_reader_wait(ipx_ring_t *ring, int msec)
 {
-    // Consider previous memory block as processed
-    ring->reader.data_idx += ring->reader.last;
-    ring->reader.read_idx += ring->reader.last;
-    ring->reader.last = 0;
-
-    if (ring->reader.size == ring->reader.data_idx) {
-        // The end of the ring buffer has been reached -> skip to the beginning
-        ring->reader.data_idx = 0;
+#ifdef __linux__
+    if (ring->event_fd >= 0) {
+        struct pollfd pfd = {ring->event_fd, POLLIN, 0};
+        if (poll(&pfd, 1, msec) > 0) {
+            eventfd_t value;
+            eventfd_read(ring->event_fd, &value);
+        }
+        return;
     }
-
-    // Prepare the next pointer to read
-    ipx_msg_t **msg = &ring->data[ring->reader.data_idx];
-
-    // Sync positions with writers, if necessary
-    if (ring->reader.read_idx - ring->reader.read_commit_idx >= ring->reader.div_block) {
-        pthread_mutex_lock(&ring->sync.mutex);
-        ring->sync.write_idx += ring->reader.read_idx - ring->reader.read_commit_idx;
-        ring->reader.exchange_idx = ring->sync.read_idx;
-        ring->reader.read_commit_idx = ring->reader.read_idx;
-        pthread_cond_signal(&ring->sync.cond_writer);
-        pthread_mutex_unlock(&ring->sync.mutex);
+#endif
+    struct timespec ts = {0, 1000000L};
+    for (int i = 0; i < msec && __atomic_load_n(&ring->waiting, __ATOMIC_RELAXED); i++) {
+        nanosleep(&ts, NULL);
     }
+}
+
+uint32_t
+ipx_ring_pop_burst(ipx_ring_t *ring, ipx_msg_t **msgs, uint32_t max)
+{
+    uint32_t cnt;
 
-    if (ring->reader.exchange_idx - ring->reader.read_idx > 0) {
-        // Ok, the reader owns this part of the buffer
-        // TODO: prefetch
-        ring->reader.last = 1;
-        return *msg; // Now, we can dereference the pointer
+    // Consider previously read messages as processed
+    if (ring->done_idx != ring->read_idx) {
+        __atomic_store_n(&ring->done_idx, ring->read_idx, __ATOMIC_RELEASE);
     }
 
-    while (1) {
-        // The reader has reached the end of the filled memory -> try to sync
-        pthread_mutex_lock(&ring->sync.mutex);
-        pthread_cond_signal(&ring->sync.cond_writer);
-        // Wait until a writer sends a signal or a timeout expires
-        ring_cond_timedwait(&ring->sync.cond_reader, &ring->sync.mutex, 10);
-        ring->reader.exchange_idx = ring->sync.read_idx;
-        pthread_mutex_unlock(&ring->sync.mutex);
-
-        if (ring->reader.exchange_idx - ring->reader.read_idx > 0) {
-            // TODO: prefetch
-            ring->reader.last = 1;
-            return *msg; // Now, we can dereference the pointer
+    for (uint32_t i = 0; i < ring->reader_spin; i++) {
+        if ((cnt = ring_take(ring, msgs, max)) > 0) {
+            return cnt;
         }
-
-        // Writer still didn't perform sync -> try to steal all committed messages from writer
-        pthread_mutex_lock(&ring->sync.mutex);
-        ring->sync.read_idx = ring->reader.exchange_idx = __sync_fetch_and_add(&ring->writer.write_idx, 0);
-        pthread_mutex_unlock(&ring->sync.mutex);
-
-        if (ring->reader.exchange_idx - ring->reader.read_idx > 0) {
-            // TODO: prefetch
-            ring->reader.last = 1;
-            return *msg; // Now, we can dereference the pointer
+    }
+    for (uint32_t i = 0; i < ring->reader_yield; i++) {
+        sched_yield();
+        if ((cnt = ring_take(ring, msgs, max)) > 0) {
+            return cnt;
         }
-        break;
     }
-    return NULL;
+
+    __atomic_store_n(&ring->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ((cnt = ring_take(ring, msgs, max)) == 0) {
+        ring_reader_wait(ring, RING_READER_WAIT);
+        cnt = ring_take(ring, msgs, max);
+    }
+    __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+    return cnt;
+}
+
+ipx_msg_t *
+ipx_ring_pop(ipx_ring_t *ring)
+{
+    ipx_msg_t *msg;
+    return ipx_ring_pop_burst(ring, &msg, 1) ? msg : NULL;
+}
+
+void
+ipx_ring_reader_idle(ipx_ring_t *ring, uint32_t spin, uint32_t yield)
+{
+    ring->reader_spin = spin;
+    ring->reader_yield = yield;
 }
 
 void
@@ -471,11 +431,18 @@ ipx_ring_mw_mode(ipx_ring_t *ring, bool mode)
 IPX_API uint32_t
 ipx_ring_cnt(const ipx_ring_t *ring)
 {
-   return ring->writer.write_idx - ring->reader.read_idx;
+   return __atomic_load_n(&ring->write_idx, __ATOMIC_RELAXED) -
+      __atomic_load_n(&ring->done_idx, __ATOMIC_ACQUIRE);
 }
 
 IPX_API uint32_t
 ipx_ring_size(const ipx_ring_t *ring)
 {
-   return ring->reader.size;
+   return ring->size;
+}
+
+IPX_API int
+ipx_ring_fd(const ipx_ring_t *ring)
+{
+   return ring->event_fd;
 }
@@ -43,6 +43,7 @@
 
 #include <config.h>
 #include <string>
+#include <iomanip>
 
 #include <string.h>
 #include <unistd.h>
@@ -162,4 +163,57 @@ std::string create_sockpath(const char *id)
    return DEFAULTSOCKETDIR "/ipfixprobe_" + std::string(id) + ".sock";
 }
 
+size_t print_cache_stats(std::ostream &os, const CacheStats *stats, size_t cnt)
+{
+   os << "Cache stats:" << std::endl <<
+      std::setw(3) << "#" <<
+      std::setw(13) << "lookups" <<
+      std::setw(13) << "hits" <<
+      std::setw(13) << "empty" <<
+      std::setw(13) << "flushed" <<
+      std::setw(13) << "skipped" <<
+      std::setw(13) << "flows" <<
+      std::setw(13) << "size" << std::endl;
+   for (size_t idx = 0; idx < cnt; idx++) {
+      os <<
+         std::setw(3) << idx << " " <<
+         std::setw(12) << stats[idx].lookups << " " <<
+         std::setw(12) << stats[idx].hits << " " <<
+         std::setw(12) << stats[idx].empty << " " <<
+         std::setw(12) << stats[idx].flushed << " " <<
+         std::setw(12) << stats[idx].skipped << " " <<
+         std::setw(12) << stats[idx].flows << " " <<
+         std::setw(12) << stats[idx].size << std::endl;
+   }
+
+   os << std::endl << "Cache exports by end reason:" << std::endl <<
+      std::setw(3) << "#" <<
+      std::setw(13) << "inactive" <<
+      std::setw(13) << "active" <<
+      std::setw(13) << "eof" <<
+      std::setw(13) << "forced" <<
+      std::setw(13) << "no-res" << std::endl;
+   for (size_t idx = 0; idx < cnt; idx++) {
+      os << std::setw(3) << idx;
+      for (int reason = FLOW_END_INACTIVE; reason <= FLOW_END_NO_RES; reason++) {
+         os << " " << std::setw(12) << stats[idx].exported[reason];
+      }
+      os << std::endl;
+   }
+
+   os << std::endl << "Cache hits by probe depth:" << std::endl << std::setw(3) << "#";
+   for (int bucket = 0; bucket < CACHE_STATS_PROBE_DEPTHS - 1; bucket++) {
+      os << std::setw(10) << ("<=" + std::to_string(1 << bucket));
+   }
+   os << std::setw(10) << ">" + std::to_string(1 << (CACHE_STATS_PROBE_DEPTHS - 2)) << std::endl;
+   for (size_t idx = 0; idx < cnt; idx++) {
+      os << std::setw(3) << idx;
+      for (int bucket = 0; bucket < CACHE_STATS_PROBE_DEPTHS; bucket++) {
+         os << " " << std::setw(9) << stats[idx].probe_depth[bucket];
+      }
+      os << std::endl;
+   }
+   return 3 * cnt + 8;
+}
+
 }
@@ -44,6 +44,10 @@
 #ifndef IPXP_STATS_HPP
 #define IPXP_STATS_HPP
 
+#include <ostream>
+
+#include <ipfixprobe/storage.hpp>
+
 #define SERVICE_WAIT_BEFORE_TIMEOUT 250000  ///< Timeout after EAGAIN or EWOULDBLOCK errno returned from service send() and recv().
 #define SERVICE_WAIT_MAX_TRY 8  ///< A maximal count of repeated timeouts per each service recv() and send() function call.
 
@@ -58,6 +62,8 @@ struct InputStats {
    uint64_t bytes;
    uint64_t qtime;
    uint64_t dropped;
+   uint64_t busy; /**< Reads which returned packets. */
+   uint64_t idle; /**< Reads which returned no packets. */
 };
 
 struct OutputStats {
@@ -65,6 +71,8 @@ struct OutputStats {
    uint64_t bytes;
    uint64_t packets;
    uint64_t dropped;
+   uint64_t busy; /**< Reads of the queue which returned flows. */
+   uint64_t idle; /**< Reads of the queue which returned no flows. */
 };
 
 typedef struct msg_header_s
@@ -73,6 +81,7 @@ typedef struct msg_header_s
    uint16_t size;
    uint16_t inputs;
    uint16_t outputs;
+   uint16_t caches;
 
    // followed by arrays of plugin stats
 } msg_header_t;
@@ -83,5 +92,11 @@ int recv_data(int sd, uint32_t size, void *data);
 int send_data(int sd, uint32_t size, void *data);
 std::string create_sockpath(const char *id);
 
+/**
+ * \brief Print flow cache counters as tables.
+ * \return Number of printed lines.
+ */
+size_t print_cache_stats(std::ostream &os, const CacheStats *stats, size_t cnt);
+
 }
 #endif /* IPXP_STATS_HPP */
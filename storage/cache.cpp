@@ -46,24 +46,78 @@
  */
 
 #include <cstdlib>
+#include <algorithm>
 #include <iostream>
 #include <cstring>
+#include <new>
 #include <sys/time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <limits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include <ipfixprobe/ring.h>
+#include <ipfixprobe/clock.hpp>
 #include "cache.hpp"
 #include "xxhash.h"
 
 namespace ipxp {
 
+#if defined(__AVX2__)
+static const uint32_t TAG_CHUNK = 32;
+#else
+static const uint32_t TAG_CHUNK = 16;
+#endif
+
+/**
+ * \brief Compare one chunk of slot tags with a tag.
+ * \param [in] tags Pointer to TAG_CHUNK slot tags.
+ * \param [in] tag Searched tag.
+ * \return Bit mask of matching slots.
+ */
+static inline __attribute__((always_inline)) uint32_t match_tags(const uint8_t *tags, uint8_t tag)
+{
+#if defined(__AVX2__)
+   __m256i line = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tags));
+   return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(line, _mm256_set1_epi8(tag))));
+#elif defined(__SSE2__)
+   __m128i line = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tags));
+   return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(line, _mm_set1_epi8(tag))));
+#else
+   uint32_t mask = 0;
+   for (uint32_t i = 0; i < TAG_CHUNK; i++) {
+      mask |= static_cast<uint32_t>(tags[i] == tag) << i;
+   }
+   return mask;
+#endif
+}
+
+/**
+ * \brief Get probe depth histogram bucket, buckets cover powers of two.
+ * \param [in] depth Position of the flow in its line counted from 1.
+ */
+static inline uint32_t probe_depth_bucket(uint32_t depth)
+{
+   uint32_t bucket = depth <= 1 ? 0 : 32 - __builtin_clz(depth - 1);
+   return bucket < CACHE_STATS_PROBE_DEPTHS ? bucket : CACHE_STATS_PROBE_DEPTHS - 1;
+}
+
 __attribute__((constructor)) static void register_this_plugin()
 {
    static PluginRecord rec = PluginRecord("cache", [](){return new NHTFlowCache();});
    register_plugin(&rec);
 }
 
-FlowRecord::FlowRecord()
+FlowRecord::FlowRecord(FlowMeta *meta) : m_meta(meta)
 {
+   m_meta->m_hot = this;
    erase();
 };
 
@@ -72,113 +126,149 @@ FlowRecord::~FlowRecord()
    erase();
 };
 
+/**
+ * \brief Copy flow of another record, both parts of the record stay linked together.
+ */
+FlowRecord &FlowRecord::operator=(const FlowRecord &other)
+{
+   m_hash = other.m_hash;
+   m_time_last = other.m_time_last;
+   m_src_bytes = other.m_src_bytes;
+   m_dst_bytes = other.m_dst_bytes;
+   m_src_packets = other.m_src_packets;
+   m_dst_packets = other.m_dst_packets;
+   m_src_tcp_flags = other.m_src_tcp_flags;
+   m_dst_tcp_flags = other.m_dst_tcp_flags;
+   m_swapped = other.m_swapped;
+   m_referenced = other.m_referenced;
+   m_inactive = other.m_inactive;
+   m_meta->m_flow = other.m_meta->m_flow;
+   return *this;
+}
+
 void FlowRecord::erase()
 {
-   m_flow.remove_extensions();
+   Flow &flow = m_meta->m_flow;
+   flow.remove_extensions();
    m_hash = 0;
-
-   memset(&m_flow.time_first, 0, sizeof(m_flow.time_first));
-   memset(&m_flow.time_last, 0, sizeof(m_flow.time_last));
-   m_flow.ip_version = 0;
-   m_flow.ip_proto = 0;
-   memset(&m_flow.src_ip, 0, sizeof(m_flow.src_ip));
-   memset(&m_flow.dst_ip, 0, sizeof(m_flow.dst_ip));
-   m_flow.src_port = 0;
-   m_flow.dst_port = 0;
-   m_flow.src_packets = 0;
-   m_flow.dst_packets = 0;
-   m_flow.src_bytes = 0;
-   m_flow.dst_bytes = 0;
-   m_flow.src_tcp_flags = 0;
-   m_flow.dst_tcp_flags = 0;
+   m_swapped = false;
+   m_referenced = false;
+
+   memset(&flow.time_first, 0, sizeof(flow.time_first));
+   memset(&m_time_last, 0, sizeof(m_time_last));
+   flow.ip_version = 0;
+   flow.ip_proto = 0;
+   memset(&flow.src_ip, 0, sizeof(flow.src_ip));
+   memset(&flow.dst_ip, 0, sizeof(flow.dst_ip));
+   flow.src_port = 0;
+   flow.dst_port = 0;
+   m_src_packets = 0;
+   m_dst_packets = 0;
+   m_src_bytes = 0;
+   m_dst_bytes = 0;
+   m_src_tcp_flags = 0;
+   m_dst_tcp_flags = 0;
+   sync();
 }
 void FlowRecord::reuse()
 {
-   m_flow.remove_extensions();
-   m_flow.time_first = m_flow.time_last;
-   m_flow.src_packets = 0;
-   m_flow.dst_packets = 0;
-   m_flow.src_bytes = 0;
-   m_flow.dst_bytes = 0;
-   m_flow.src_tcp_flags = 0;
-   m_flow.dst_tcp_flags = 0;
-}
-
-inline __attribute__((always_inline)) bool FlowRecord::is_empty() const
-{
-   return m_hash == 0;
+   m_meta->m_flow.remove_extensions();
+   m_meta->m_flow.time_first = m_time_last;
+   m_src_packets = 0;
+   m_dst_packets = 0;
+   m_src_bytes = 0;
+   m_dst_bytes = 0;
+   m_src_tcp_flags = 0;
+   m_dst_tcp_flags = 0;
 }
 
-inline __attribute__((always_inline)) bool FlowRecord::belongs(uint64_t hash) const
+/**
+ * \brief Copy per packet fields to the cold flow, so that it can be passed to plugins or exported.
+ */
+void FlowRecord::sync()
 {
-   return hash == m_hash;
+   Flow &flow = m_meta->m_flow;
+   flow.time_last = m_time_last;
+   flow.src_bytes = m_src_bytes;
+   flow.dst_bytes = m_dst_bytes;
+   flow.src_packets = m_src_packets;
+   flow.dst_packets = m_dst_packets;
+   flow.src_tcp_flags = m_src_tcp_flags;
+   flow.dst_tcp_flags = m_dst_tcp_flags;
 }
 
 void FlowRecord::create(const Packet &pkt, uint64_t hash)
 {
-   m_flow.src_packets = 1;
+   Flow &flow = m_meta->m_flow;
+   m_src_packets = 1;
 
    m_hash = hash;
 
-   m_flow.time_first = pkt.ts;
-   m_flow.time_last = pkt.ts;
+   flow.time_first = pkt.ts;
+   m_time_last = pkt.ts;
 
-   memcpy(m_flow.src_mac, pkt.src_mac, 6);
-   memcpy(m_flow.dst_mac, pkt.dst_mac, 6);
+   memcpy(flow.src_mac, pkt.src_mac, 6);
+   memcpy(flow.dst_mac, pkt.dst_mac, 6);
 
    if (pkt.ip_version == IP::v4) {
-      m_flow.ip_version = pkt.ip_version;
-      m_flow.ip_proto = pkt.ip_proto;
-      m_flow.src_ip.v4 = pkt.src_ip.v4;
-      m_flow.dst_ip.v4 = pkt.dst_ip.v4;
-      m_flow.src_bytes = pkt.ip_len;
+      flow.ip_version = pkt.ip_version;
+      flow.ip_proto = pkt.ip_proto;
+      flow.src_ip.v4 = pkt.src_ip.v4;
+      flow.dst_ip.v4 = pkt.dst_ip.v4;
+      m_src_bytes = pkt.ip_len;
    } else if (pkt.ip_version == IP::v6) {
-      m_flow.ip_version = pkt.ip_version;
-      m_flow.ip_proto = pkt.ip_proto;
-      memcpy(m_flow.src_ip.v6, pkt.src_ip.v6, 16);
-      memcpy(m_flow.dst_ip.v6, pkt.dst_ip.v6, 16);
-      m_flow.src_bytes = pkt.ip_len;
+      flow.ip_version = pkt.ip_version;
+      flow.ip_proto = pkt.ip_proto;
+      memcpy(flow.src_ip.v6, pkt.src_ip.v6, 16);
+      memcpy(flow.dst_ip.v6, pkt.dst_ip.v6, 16);
+      m_src_bytes = pkt.ip_len;
    }
 
    if (pkt.ip_proto == IPPROTO_TCP) {
-      m_flow.src_port = pkt.src_port;
-      m_flow.dst_port = pkt.dst_port;
-      m_flow.src_tcp_flags = pkt.tcp_flags;
+      flow.src_port = pkt.src_port;
+      flow.dst_port = pkt.dst_port;
+      m_src_tcp_flags = pkt.tcp_flags;
    } else if (pkt.ip_proto == IPPROTO_UDP) {
-      m_flow.src_port = pkt.src_port;
-      m_flow.dst_port = pkt.dst_port;
+      flow.src_port = pkt.src_port;
+      flow.dst_port = pkt.dst_port;
    } else if (pkt.ip_proto == IPPROTO_ICMP ||
       pkt.ip_proto == IPPROTO_ICMPV6) {
-      m_flow.src_port = pkt.src_port;
-      m_flow.dst_port = pkt.dst_port;
+      flow.src_port = pkt.src_port;
+      flow.dst_port = pkt.dst_port;
    }
 }
 
 void FlowRecord::update(const Packet &pkt, bool src)
 {
-   m_flow.time_last = pkt.ts;
+   m_time_last = pkt.ts;
    if (src) {
-      m_flow.src_packets++;
-      m_flow.src_bytes += pkt.ip_len;
+      m_src_packets++;
+      m_src_bytes += pkt.ip_len;
 
       if (pkt.ip_proto == IPPROTO_TCP) {
-         m_flow.src_tcp_flags |= pkt.tcp_flags;
+         m_src_tcp_flags |= pkt.tcp_flags;
       }
    } else {
-      m_flow.dst_packets++;
-      m_flow.dst_bytes += pkt.ip_len;
+      m_dst_packets++;
+      m_dst_bytes += pkt.ip_len;
 
       if (pkt.ip_proto == IPPROTO_TCP) {
-         m_flow.dst_tcp_flags |= pkt.tcp_flags;
+         m_dst_tcp_flags |= pkt.tcp_flags;
       }
    }
 }
 
 
+static const char SNAPSHOT_MAGIC[8] = {'I', 'P', 'X', 'P', 'S', 'N', 'A', 'P'};
+static const uint32_t SNAPSHOT_VERSION = 2;
+static const size_t SNAPSHOT_EXT_MAX = 65535; // largest saved extension
+static std::atomic<unsigned> s_snapshot_index(0);
+
 NHTFlowCache::NHTFlowCache() :
-   m_cache_size(0), m_line_size(0), m_line_mask(0), m_line_new_idx(0),
-   m_qsize(0), m_qidx(0), m_timeout_idx(0), m_active(0), m_inactive(0),
-   m_split_biflow(false), m_keylen(0), m_key(), m_key_inv(), m_flow_table(nullptr), m_flow_records(nullptr)
+   m_line_size(0), m_line_new_idx(0), m_pool_size(0), m_spare_cnt(0), m_grow_ratio(0),
+   m_eviction(EvictionPolicy::MIDPOINT), m_protect(0), m_rx_hash_min(RxHash::NONE), m_active(0), m_inactive(0), m_linger(0), m_min_inactive(1),
+   m_split_biflow(false), m_key_fields(0), m_sampling(1), m_sample_limit(0), m_flow_spare(nullptr), m_release(nullptr), m_pool_stalled(false),
+   m_flow_offset(0), m_export_cnt(0)
 {
 }
 
@@ -196,282 +286,1583 @@ void NHTFlowCache::init(const char *params)
       throw PluginError(e.what());
    }
 
-   m_cache_size = parser.m_cache_size;
+   uint32_t v4_size = parser.m_cache_size;
+   uint32_t v6_size = parser.m_v6_size;
+   if (v6_size == 0) {
+      v6_size = max<uint32_t>(max<uint32_t>(v4_size / 4, parser.m_line_size), 16);
+   }
    m_line_size = parser.m_line_size;
    m_active = parser.m_active;
    m_inactive = parser.m_inactive;
-   m_qidx = 0;
-   m_timeout_idx = 0;
-   m_line_mask = (m_cache_size - 1) & ~(m_line_size - 1);
-   m_line_new_idx = m_line_size / 2;
+   m_linger = parser.m_linger ? parser.m_linger : std::numeric_limits<uint32_t>::max();
+   for (uint32_t i = 0; i < 256; i++) {
+      m_proto_timeout[i] = m_inactive;
+   }
+   m_port_timeouts.clear();
+   for (const TimeoutClass &cls : parser.m_timeout_classes) {
+      if (cls.any_port) {
+         m_proto_timeout[cls.proto] = cls.timeout;
+      } else {
+         m_port_timeouts.push_back(cls);
+      }
+   }
+   m_min_inactive = m_linger;
+   for (uint32_t i = 0; i < 256; i++) {
+      m_min_inactive = std::min(m_min_inactive, m_proto_timeout[i]);
+   }
+   for (const TimeoutClass &cls : m_port_timeouts) {
+      m_min_inactive = std::min(m_min_inactive, cls.timeout);
+   }
+   m_min_inactive = std::max<uint32_t>(m_min_inactive, 1);
+   m_grow_ratio = parser.m_grow_ratio;
+   m_eviction = parser.m_eviction;
+   m_protect = parser.m_protect;
+   if (m_eviction == EvictionPolicy::MIDPOINT || m_eviction == EvictionPolicy::PROTECT) {
+      m_line_new_idx = m_line_size / 2;
+   } else {
+      m_line_new_idx = 0;
+   }
 
    if (m_export_queue == nullptr) {
       throw PluginError("output queue must be set before init");
    }
 
-   if (m_line_size > m_cache_size) {
+   if (m_line_size > v4_size || m_line_size > v6_size) {
       throw PluginError("flow cache line size must be greater or equal to cache size");
    }
-   if (m_cache_size == 0) {
+   if (v4_size == 0) {
       throw PluginError("flow cache won't properly work with 0 records");
    }
 
+   m_memory.m_hugepages = parser.m_hugepages;
+   m_memory.m_numa_node = parser.m_numa_node == NUMA_NODE_AUTO ? get_current_numa_node() : parser.m_numa_node;
+
+   m_key_fields = parser.m_key_fields;
+   uint32_t v4_admit = parser.m_admit_size;
+   uint32_t v6_admit = v4_admit ? max<uint32_t>(v4_admit / 4, 16) : 0;
+   if (m_key_fields) {
+      init_table(m_v4x, v4_size, max<uint32_t>(parser.m_max_size, v4_size), v4_admit, "IPv4");
+      init_table(m_v6x, v6_size, max<uint32_t>(parser.m_max_size, v6_size), v6_admit, "IPv6");
+   } else {
+      init_table(m_v4, v4_size, max<uint32_t>(parser.m_max_size, v4_size), v4_admit, "IPv4");
+      init_table(m_v6, v6_size, max<uint32_t>(parser.m_max_size, v6_size), v6_admit, "IPv6");
+   }
+
+   // Records in flight between the cache and outputs come from a fixed pool, its size does not depend on the export queue
+   m_pool_size = parser.m_export_pool;
    try {
-      m_flow_table = new FlowRecord*[m_cache_size + m_qsize];
-      m_flow_records = new FlowRecord[m_cache_size + m_qsize];
-      for (decltype(m_cache_size + m_qsize) i = 0; i < m_cache_size + m_qsize; i++) {
-         m_flow_table[i] = m_flow_records + i;
-      }
+      m_flow_spare = new FlowRecord*[m_pool_size]();
+      m_release = new SPSCRing<Flow *>(m_pool_size);
    } catch (std::bad_alloc &e) {
       throw PluginError("not enough memory for flow cache allocation");
    }
+   FlowRecord *records;
+   FlowMeta *meta;
+   if (!alloc_records(m_pool_size, records, meta)) {
+      throw PluginError("not enough memory for flow cache allocation");
+   }
+   for (uint32_t i = 0; i < m_pool_size; i++) {
+      m_flow_spare[i] = new (records + i) FlowRecord(new (meta + i) FlowMeta());
+   }
+   m_spare_cnt = m_pool_size;
+   m_flow_offset = reinterpret_cast<uint8_t *>(&meta->m_flow) - reinterpret_cast<uint8_t *>(meta);
 
    m_split_biflow = parser.m_split_biflow;
+   if (parser.m_rx_hash == RxHashMode::OFF) {
+      m_rx_hash_min = RxHash::NONE;
+   } else if (parser.m_rx_hash == RxHashMode::FORCE || m_split_biflow) {
+      m_rx_hash_min = RxHash::ASYMMETRIC;
+   } else {
+      m_rx_hash_min = RxHash::SYMMETRIC;
+   }
+   m_sampling = parser.m_sampling;
+   m_sample_limit = (static_cast<uint64_t>(1) << 32) / m_sampling;
+
+   memset(&m_stats, 0, sizeof(m_stats));
+
+   if (!parser.m_snapshot.empty()) {
+      // Caches are initialized in the same order on every start, so each one finds its own file
+      m_snapshot = parser.m_snapshot + "." + std::to_string(s_snapshot_index++);
+      load_snapshot();
+      flush_exports();
+   }
+}
+
+/**
+ * \brief Map arrays of a flow table and construct its records.
+ * \param [out] table Initialized table.
+ * \param [in] size Number of slots.
+ * \param [in] max_size Number of slots the table can grow to.
+ * \param [in] admit_size Number of admission filter entries, 0 when filter is not used.
+ * \param [in] name Name of the table used in error messages.
+ */
+template <typename Key>
+void NHTFlowCache::init_table(FlowTable<Key> &table, uint32_t size, uint32_t max_size, uint32_t admit_size, const char *name)
+{
+   table.m_cache_size = size;
+   table.m_max_size = max_size;
+   table.m_line_mask = (size - 1) & ~(m_line_size - 1);
+   table.m_resize_size = 0;
+   table.m_split_idx = size;
+   table.m_old_line_mask = table.m_line_mask;
+   table.m_window_inserts = 0;
+   table.m_window_evictions = 0;
+
+   // Table arrays are mapped for the maximal size, pages of lines added by resize are touched only when split.
+   // Tags are padded so that a whole chunk can be loaded for the last line.
+   table.m_flow_table = static_cast<FlowRecord **>(alloc_array(max_size * sizeof(*table.m_flow_table), "flow table"));
+   table.m_flow_tags = static_cast<uint8_t *>(alloc_array(max_size + TAG_CHUNK, "flow tags"));
+   table.m_flow_keys = static_cast<Key *>(alloc_array(max_size * sizeof(*table.m_flow_keys), "flow keys"));
+   FlowRecord *records;
+   FlowMeta *meta;
+   if (table.m_flow_table == nullptr || table.m_flow_tags == nullptr || table.m_flow_keys == nullptr ||
+      !alloc_records(size, records, meta)) {
+      throw PluginError(std::string("not enough memory for ") + name + " flow cache allocation");
+   }
+
+   for (uint32_t i = 0; i < size; i++) {
+      table.m_flow_table[i] = new (records + i) FlowRecord(new (meta + i) FlowMeta());
+   }
+
+   if (admit_size) {
+      table.m_admit = static_cast<AdmitEntry<Key> *>(alloc_array(admit_size * sizeof(AdmitEntry<Key>), "admission filter"));
+      if (table.m_admit == nullptr) {
+         throw PluginError(std::string("not enough memory for ") + name + " admission filter allocation");
+      }
+      table.m_admit_mask = admit_size - 1;
+      table.m_admit_sweep = 0;
+      table.m_admit_time = 0;
+   }
+}
+
+/**
+ * \brief Destroy both parts of a record constructed in memory of record chunks.
+ */
+static void destroy_record(FlowRecord *flow)
+{
+   FlowMeta *meta = flow->m_meta;
+   flow->~FlowRecord();
+   meta->~FlowMeta();
+}
 
-#ifdef FLOW_CACHE_STATS
-   m_empty = 0;
-   m_not_empty = 0;
-   m_hits = 0;
-   m_expired = 0;
-   m_flushed = 0;
-   m_lookups = 0;
-   m_lookups2 = 0;
-#endif /* FLOW_CACHE_STATS */
+template <typename Key>
+void NHTFlowCache::close_table(FlowTable<Key> &table)
+{
+   if (table.m_flow_table != nullptr) {
+      for (uint32_t i = 0; i < table.m_cache_size; i++) {
+         if (table.m_flow_table[i] != nullptr) {
+            destroy_record(table.m_flow_table[i]);
+         }
+      }
+   }
+   table = FlowTable<Key>();
 }
 
 void NHTFlowCache::close()
 {
-   if (m_flow_records != nullptr) {
-      delete [] m_flow_records;
-      m_flow_records = nullptr;
+   // Every record is referenced exactly once, either from a table, from the spare stack or from outputs.
+   // Outputs are finished, so records they did not release were never exported and are only unmapped.
+   close_table(m_v4);
+   close_table(m_v6);
+   close_table(m_v4x);
+   close_table(m_v6x);
+   if (m_flow_spare != nullptr) {
+      Flow *flow;
+      while (m_release->pop(flow)) {
+         m_flow_spare[m_spare_cnt++] = reinterpret_cast<FlowMeta *>(reinterpret_cast<uint8_t *>(flow) - m_flow_offset)->m_hot;
+      }
+      for (uint32_t i = 0; i < m_spare_cnt; i++) {
+         destroy_record(m_flow_spare[i]);
+      }
+      delete [] m_flow_spare;
+      m_flow_spare = nullptr;
+      m_spare_cnt = 0;
+   }
+   delete m_release;
+   m_release = nullptr;
+
+   for (auto &mapping : m_mappings) {
+      unmap_memory(mapping.first, mapping.second);
+   }
+   m_mappings.clear();
+}
+
+/**
+ * \brief Map memory for a cache array according to memory policy. Mapping is released in close.
+ * \return Pointer to zeroed memory or nullptr on failure.
+ */
+void *NHTFlowCache::alloc_array(size_t size, const char *name)
+{
+   void *mem = map_memory(size, m_memory, name);
+   if (mem != nullptr) {
+      m_mappings.push_back(std::make_pair(mem, size));
+   }
+   return mem;
+}
+
+/**
+ * \brief Map parallel arrays of hot records and their cold parts. Records are not constructed.
+ * \return True on success.
+ */
+bool NHTFlowCache::alloc_records(uint32_t count, FlowRecord *&records, FlowMeta *&meta)
+{
+   records = static_cast<FlowRecord *>(alloc_array(count * sizeof(FlowRecord), "flow records"));
+   meta = static_cast<FlowMeta *>(alloc_array(count * sizeof(FlowMeta), "flow metadata"));
+   return records != nullptr && meta != nullptr;
+}
+
+/**
+ * \brief Take record from the spare stack. Records released by outputs are collected when the stack is empty,
+ * the cache waits for outputs when all records of the pool are exported.
+ * \throw PluginError when outputs release no record for EXPORT_POOL_TIMEOUT seconds.
+ */
+FlowRecord *NHTFlowCache::take_record()
+{
+   if (m_spare_cnt == 0) {
+      if (m_pool_stalled) {
+         throw PluginError("exported flows are not released by outputs");
+      }
+      // Records waiting for a burst would never be released otherwise
+      flush_exports();
+   }
+   time_t deadline = 0;
+   while (m_spare_cnt == 0) {
+      Flow *flow;
+      while (m_release->pop(flow)) {
+         m_flow_spare[m_spare_cnt++] = reinterpret_cast<FlowMeta *>(reinterpret_cast<uint8_t *>(flow) - m_flow_offset)->m_hot;
+      }
+      if (m_spare_cnt == 0) {
+         time_t now = CoarseClock::monotonic().tv_sec;
+         if (deadline == 0) {
+            deadline = now + EXPORT_POOL_TIMEOUT;
+         } else if (now >= deadline) {
+            m_pool_stalled = true;
+            throw PluginError("exported flows are not released by outputs");
+         }
+         usleep(1);
+      }
    }
-   if (m_flow_table != nullptr) {
-      delete [] m_flow_table;
-      m_flow_table = nullptr;
+   return m_flow_spare[--m_spare_cnt];
+}
+
+template <typename Key>
+void NHTFlowCache::export_flow(FlowTable<Key> &table, size_t index)
+{
+   FlowRecord *&flow = table.m_flow_table[index];
+   // Spare record is taken first, the table stays consistent when outputs stall
+   FlowRecord *spare = take_record();
+   uint8_t reason = flow->m_meta->m_flow.end_reason;
+   m_stats.exported[reason < CACHE_STATS_REASONS ? reason : 0]++;
+   m_stats.flows--;
+   m_timeouts.cancel(flow->m_meta);
+   flow->sync();
+   flow->m_meta->m_flow.sampling_interval = m_sampling;
+   flow->m_meta->m_flow.release_queue = m_release;
+   queue_export(&flow->m_meta->m_flow);
+   flow = spare;
+   flow->erase();
+   table.m_flow_tags[index] = FLOW_TAG_EMPTY;
+}
+
+/**
+ * \brief Find flow record in flow line by comparing slot tags and then full keys.
+ * \return Index of the flow record or index of the next line when not found.
+ */
+template <typename Key>
+uint32_t NHTFlowCache::find_flow(const FlowTable<Key> &table, uint32_t line_index, uint8_t tag, const Key &key) const
+{
+   uint32_t next_line = line_index + m_line_size;
+   for (uint32_t chunk = line_index; chunk < next_line; chunk += TAG_CHUNK) {
+      uint32_t mask = match_tags(&table.m_flow_tags[chunk], tag);
+      if (next_line - chunk < TAG_CHUNK) {
+         mask &= (static_cast<uint32_t>(1) << (next_line - chunk)) - 1;
+      }
+      while (mask) {
+         uint32_t flow_index = chunk + __builtin_ctz(mask);
+         if (!memcmp(&table.m_flow_keys[flow_index], &key, sizeof(Key))) {
+            return flow_index;
+         }
+         mask &= mask - 1;
+      }
    }
+   return next_line;
 }
 
-void NHTFlowCache::set_queue(ipx_ring_t *queue)
+/**
+ * \brief Find first empty slot in flow line.
+ * \return Index of the slot or index of the next line when line is full.
+ */
+template <typename Key>
+uint32_t NHTFlowCache::find_empty(const FlowTable<Key> &table, uint32_t line_index) const
 {
-   m_export_queue = queue;
-   m_qsize = ipx_ring_size(queue);
+   uint32_t next_line = line_index + m_line_size;
+   for (uint32_t chunk = line_index; chunk < next_line; chunk += TAG_CHUNK) {
+      uint32_t mask = match_tags(&table.m_flow_tags[chunk], FLOW_TAG_EMPTY);
+      if (next_line - chunk < TAG_CHUNK) {
+         mask &= (static_cast<uint32_t>(1) << (next_line - chunk)) - 1;
+      }
+      if (mask) {
+         return chunk + __builtin_ctz(mask);
+      }
+   }
+   return next_line;
 }
 
-void NHTFlowCache::export_flow(size_t index)
+/**
+ * \brief Select flow evicted from a full line according to the eviction policy.
+ * \return Index of the evicted flow.
+ */
+template <typename Key>
+uint32_t NHTFlowCache::find_victim(FlowTable<Key> &table, uint32_t line_index)
 {
-   ipx_ring_push(m_export_queue, &m_flow_table[index]->m_flow);
-   std::swap(m_flow_table[index], m_flow_table[m_cache_size + m_qidx]);
-   m_flow_table[index]->erase();
-   m_qidx = (m_qidx + 1) % m_qsize;
+   FlowRecord **flows = table.m_flow_table;
+   uint32_t last = line_index + m_line_size - 1;
+   uint32_t victim = last;
+
+   switch (m_eviction) {
+   case EvictionPolicy::CLOCK:
+      // Marked flows move to the front with the mark cleared, so the loop ends at latest after one round
+      for (uint32_t i = 0; i < m_line_size && flows[last]->m_referenced; i++) {
+         flows[last]->m_referenced = false;
+         move_flow(table, last, line_index);
+      }
+      break;
+   case EvictionPolicy::PROTECT:
+      for (uint32_t i = last + 1; i-- > line_index; ) {
+         if (flows[i]->m_src_packets + flows[i]->m_dst_packets <= m_protect) {
+            victim = i;
+            break;
+         }
+      }
+      break;
+   case EvictionPolicy::OLDEST:
+      for (uint32_t i = line_index; i < last; i++) {
+         const struct timeval &tv = flows[i]->m_time_last;
+         const struct timeval &oldest = flows[victim]->m_time_last;
+         if (tv.tv_sec < oldest.tv_sec || (tv.tv_sec == oldest.tv_sec && tv.tv_usec < oldest.tv_usec)) {
+            victim = i;
+         }
+      }
+      break;
+   default:
+      break;
+   }
+   return victim;
+}
+
+/**
+ * \brief Move slot to another index inside flow line, slots in between are shifted by one.
+ */
+template <typename Key>
+void NHTFlowCache::move_flow(FlowTable<Key> &table, uint32_t from, uint32_t to)
+{
+   FlowRecord *flow = table.m_flow_table[from];
+   uint8_t tag = table.m_flow_tags[from];
+   Key key = table.m_flow_keys[from];
+
+   if (from >= to) {
+      memmove(&table.m_flow_table[to + 1], &table.m_flow_table[to], (from - to) * sizeof(*table.m_flow_table));
+      memmove(&table.m_flow_tags[to + 1], &table.m_flow_tags[to], (from - to) * sizeof(*table.m_flow_tags));
+      memmove(&table.m_flow_keys[to + 1], &table.m_flow_keys[to], (from - to) * sizeof(*table.m_flow_keys));
+   } else {
+      // Victims selected by eviction policy can lie in front of the insertion index
+      memmove(&table.m_flow_table[from], &table.m_flow_table[from + 1], (to - from) * sizeof(*table.m_flow_table));
+      memmove(&table.m_flow_tags[from], &table.m_flow_tags[from + 1], (to - from) * sizeof(*table.m_flow_tags));
+      memmove(&table.m_flow_keys[from], &table.m_flow_keys[from + 1], (to - from) * sizeof(*table.m_flow_keys));
+   }
+
+   table.m_flow_table[to] = flow;
+   table.m_flow_tags[to] = tag;
+   table.m_flow_keys[to] = key;
+}
+
+/**
+ * \brief Get index of flow line for given hash. Lines which were not split yet by a running resize
+ * hold flows of both their halves.
+ */
+template <typename Key>
+inline uint32_t NHTFlowCache::get_line_index(const FlowTable<Key> &table, uint64_t hash) const
+{
+   uint32_t line_index = hash & table.m_line_mask;
+   uint32_t old_index = hash & table.m_old_line_mask;
+   return old_index < table.m_split_idx ? line_index : old_index;
+}
+
+/**
+ * \brief Count new flows and evictions, start growing the table when evictions are too frequent.
+ * \param [in] evicted Another flow was evicted to make room for the new one.
+ */
+template <typename Key>
+void NHTFlowCache::check_pressure(FlowTable<Key> &table, bool evicted)
+{
+   table.m_window_inserts++;
+   table.m_window_evictions += evicted;
+   if (table.m_window_inserts < table.m_cache_size / 4) {
+      return;
+   }
+
+   if (table.m_resize_size == 0 && table.m_cache_size < table.m_max_size &&
+      static_cast<uint64_t>(table.m_window_evictions) * 100 > static_cast<uint64_t>(table.m_window_inserts) * m_grow_ratio) {
+      start_resize(table);
+   }
+   table.m_window_inserts = 0;
+   table.m_window_evictions = 0;
+}
+
+/**
+ * \brief Double the table. Lines are then split incrementally by resize_step.
+ * Table only grows, lines of the table before resize become its lower half, so there is no old table to free.
+ */
+template <typename Key>
+void NHTFlowCache::start_resize(FlowTable<Key> &table)
+{
+   if (!alloc_records(table.m_cache_size, table.m_resize_records, table.m_resize_meta)) {
+      std::cerr << "cache: not enough memory to grow flow cache, keeping " << table.m_cache_size << " records" << std::endl;
+      table.m_max_size = table.m_cache_size;
+      return;
+   }
+
+   table.m_resize_size = table.m_cache_size;
+   table.m_old_line_mask = table.m_line_mask;
+   table.m_split_idx = 0;
+   table.m_cache_size *= 2;
+   table.m_line_mask = (table.m_cache_size - 1) & ~(m_line_size - 1);
+}
+
+/**
+ * \brief Move flows of one line of the table before resize whose hash selects the upper half of the new table.
+ * Order of flows in both lines is preserved.
+ */
+template <typename Key>
+void NHTFlowCache::split_line(FlowTable<Key> &table, uint32_t line_index)
+{
+   uint32_t next_line = line_index + m_line_size;
+   uint32_t new_line = line_index + table.m_resize_size;
+   uint32_t to = new_line;
+   uint32_t keep = line_index;
+
+   for (uint32_t i = new_line; i < new_line + m_line_size; i++) {
+      table.m_flow_table[i] = new (table.m_resize_records + i - table.m_resize_size)
+         FlowRecord(new (table.m_resize_meta + i - table.m_resize_size) FlowMeta());
+   }
+
+   for (uint32_t i = line_index; i < next_line; i++) {
+      if (table.m_flow_tags[i] == FLOW_TAG_EMPTY) {
+         continue;
+      }
+      uint32_t dst = (table.m_flow_table[i]->m_hash & table.m_resize_size) ? to++ : keep++;
+      if (dst != i) {
+         std::swap(table.m_flow_table[dst], table.m_flow_table[i]);
+         table.m_flow_tags[dst] = table.m_flow_tags[i];
+         table.m_flow_keys[dst] = table.m_flow_keys[i];
+         table.m_flow_tags[i] = FLOW_TAG_EMPTY;
+      }
+   }
+}
+
+/**
+ * \brief Split few lines of a running resize.
+ */
+template <typename Key>
+void NHTFlowCache::resize_step(FlowTable<Key> &table)
+{
+   for (uint32_t i = 0; i < RESIZE_LINES_PER_PKT && table.m_split_idx < table.m_resize_size; i++) {
+      split_line(table, table.m_split_idx);
+      table.m_split_idx += m_line_size;
+   }
+   if (table.m_split_idx >= table.m_resize_size) {
+      // Split was done in place and every record stays in use, only the resize state is dropped
+      table.m_resize_size = 0;
+      table.m_resize_records = nullptr;
+      table.m_resize_meta = nullptr;
+      table.m_old_line_mask = table.m_line_mask;
+      table.m_split_idx = table.m_cache_size;
+   }
+}
+
+/**
+ * \brief Find slot of a stored flow record. Records stay in the flow line given by their hash.
+ * \return Index of the slot or index of the next line when record is not stored.
+ */
+template <typename Key>
+uint32_t NHTFlowCache::find_record(const FlowTable<Key> &table, const FlowRecord *flow) const
+{
+   uint32_t line_index = get_line_index(table, flow->m_hash);
+   uint32_t next_line = line_index + m_line_size;
+   for (uint32_t flow_index = line_index; flow_index < next_line; flow_index++) {
+      if (table.m_flow_table[flow_index] == flow) {
+         return flow_index;
+      }
+   }
+   return next_line;
+}
+
+/**
+ * \brief Get time at which flow record expires by inactive or active timeout.
+ */
+time_t NHTFlowCache::get_expiration(const FlowRecord *flow) const
+{
+   time_t inactive = flow->m_time_last.tv_sec + flow->m_inactive;
+   time_t active = flow->m_meta->m_flow.time_first.tv_sec + m_active;
+   return inactive < active ? inactive : active;
+}
+
+/**
+ * \brief Get inactive timeout of a new flow. Port classes take precedence over protocol ones,
+ * flows which have already seen TCP FIN or RST get the linger timeout when it is shorter.
+ */
+uint32_t NHTFlowCache::get_timeout(uint8_t proto, uint16_t src_port, uint16_t dst_port, uint8_t tcp_flags) const
+{
+   uint32_t timeout = m_proto_timeout[proto];
+   for (const TimeoutClass &cls : m_port_timeouts) {
+      if (cls.proto == proto && (cls.port == src_port || cls.port == dst_port)) {
+         timeout = cls.timeout;
+         break;
+      }
+   }
+   if ((tcp_flags & (0x01 | 0x04)) && m_linger < timeout) {
+      timeout = m_linger;
+   }
+   return timeout;
+}
+
+/**
+ * \brief Shorten inactive timeout of a TCP flow to the linger timeout once FIN or RST was seen.
+ * Deadlines are re-checked only when they elapse, so the flow is moved to its earlier one.
+ */
+void NHTFlowCache::check_linger(FlowRecord *flow)
+{
+   if (!((flow->m_src_tcp_flags | flow->m_dst_tcp_flags) & (0x01 | 0x04)) || flow->m_inactive <= m_linger) {
+      return;
+   }
+   flow->m_inactive = m_linger;
+   time_t expire = get_expiration(flow);
+   if (flow->m_meta->is_scheduled() && expire < flow->m_meta->get_expire()) {
+      m_timeouts.cancel(flow->m_meta);
+      m_timeouts.schedule(flow->m_meta, expire);
+   }
+}
+
+template <typename Key>
+void NHTFlowCache::finish_table(FlowTable<Key> &table)
+{
+   for (uint32_t i = 0; i < table.m_cache_size; i++) {
+      if (table.m_flow_tags[i] != FLOW_TAG_EMPTY) {
+         FlowRecord *flow = table.m_flow_table[i];
+         flow->sync();
+         plugins_pre_export(flow->m_meta->m_flow);
+         flow->m_meta->m_flow.end_reason = FLOW_END_FORCED;
+         export_flow(table, i);
+      }
+   }
+   if (table.m_admit != nullptr) {
+      for (uint32_t i = 0; i <= table.m_admit_mask; i++) {
+         if (table.m_admit[i].m_used) {
+            export_first(table.m_admit[i], FLOW_END_FORCED);
+         }
+      }
+   }
 }
 
 void NHTFlowCache::finish()
 {
-   for (decltype(m_cache_size) i = 0; i < m_cache_size; i++) {
-      if (!m_flow_table[i]->is_empty()) {
-         plugins_pre_export(m_flow_table[i]->m_flow);
-         m_flow_table[i]->m_flow.end_reason = FLOW_END_FORCED;
-         export_flow(i);
-#ifdef FLOW_CACHE_STATS
-         m_expired++;
-#endif /* FLOW_CACHE_STATS */
+   // Flows which were not saved (e.g. flows with plugin extensions) are exported as usual
+   if (!m_snapshot.empty()) {
+      save_snapshot();
+   }
+   if (m_pool_stalled) {
+      std::cerr << "cache: outputs do not release exported flows, dropping " << m_stats.flows << " flows" << std::endl;
+      return;
+   }
+   finish_table(m_v4);
+   finish_table(m_v6);
+   finish_table(m_v4x);
+   finish_table(m_v6x);
+   flush_exports();
+}
+
+/**
+ * \brief Write flows of the table with their extensions to the snapshot file and remove them from the table.
+ * Flows with an extension which cannot be saved stay in the table and are counted in skipped,
+ * all flows stay in the table once a write fails.
+ */
+template <typename Key>
+void NHTFlowCache::save_table(FlowTable<Key> &table, FILE *file, uint64_t &count, uint64_t &skipped, bool &ok)
+{
+   std::vector<uint8_t> exts;
+   size_t exts_size;
+   for (uint32_t i = 0; i < table.m_cache_size && ok; i++) {
+      FlowRecord *flow = table.m_flow_table[i];
+      if (table.m_flow_tags[i] == FLOW_TAG_EMPTY) {
+         continue;
+      }
+      if (!save_exts(flow->m_meta->m_flow, exts, exts_size)) {
+         skipped++;
+         continue;
       }
+
+      flow->sync();
+      const Flow &src = flow->m_meta->m_flow;
+      SnapshotRecord dst;
+      memset(&dst, 0, sizeof(dst));
+      dst.hash = flow->m_hash;
+      dst.time_first_sec = src.time_first.tv_sec;
+      dst.time_first_usec = src.time_first.tv_usec;
+      dst.time_last_sec = src.time_last.tv_sec;
+      dst.time_last_usec = src.time_last.tv_usec;
+      dst.src_bytes = src.src_bytes;
+      dst.dst_bytes = src.dst_bytes;
+      dst.src_packets = src.src_packets;
+      dst.dst_packets = src.dst_packets;
+      dst.src_tcp_flags = src.src_tcp_flags;
+      dst.dst_tcp_flags = src.dst_tcp_flags;
+      dst.ip_version = src.ip_version;
+      dst.ip_proto = src.ip_proto;
+      dst.src_port = src.src_port;
+      dst.dst_port = src.dst_port;
+      dst.src_ip = src.src_ip;
+      dst.dst_ip = src.dst_ip;
+      memcpy(dst.src_mac, src.src_mac, sizeof(dst.src_mac));
+      memcpy(dst.dst_mac, src.dst_mac, sizeof(dst.dst_mac));
+      dst.swapped = flow->m_swapped;
+      memcpy(dst.key, &table.m_flow_keys[i], sizeof(Key));
+      dst.ext_size = exts_size;
+      if (fwrite(&dst, sizeof(dst), 1, file) != 1 || (exts_size && fwrite(exts.data(), exts_size, 1, file) != 1)) {
+         ok = false;
+         break;
+      }
+      count++;
+
+      m_timeouts.cancel(flow->m_meta);
+      flow->erase();
+      table.m_flow_tags[i] = FLOW_TAG_EMPTY;
+      m_stats.flows--;
    }
 }
 
-void NHTFlowCache::flush(Packet &pkt, size_t flow_index, int ret, bool source_flow)
+/**
+ * \brief Serialize extensions of the flow, each one as SnapshotExt followed by its data.
+ * \param [in,out] buffer Buffer for saved extensions, grows when needed.
+ * \param [out] size Size of saved extensions.
+ * \return False when an extension cannot be saved.
+ */
+bool NHTFlowCache::save_exts(const Flow &flow, std::vector<uint8_t> &buffer, size_t &size) const
 {
-#ifdef FLOW_CACHE_STATS
-   m_flushed++;
-#endif /* FLOW_CACHE_STATS */
+   size = 0;
+   for (const RecordExt *ext = flow.m_exts; ext != nullptr; ext = ext->m_next) {
+      if (buffer.size() < size + sizeof(SnapshotExt) + SNAPSHOT_EXT_MAX) {
+         buffer.resize(size + sizeof(SnapshotExt) + SNAPSHOT_EXT_MAX);
+      }
+      int len = ext->save(buffer.data() + size + sizeof(SnapshotExt), SNAPSHOT_EXT_MAX);
+      if (len < 0) {
+         return false;
+      }
+      SnapshotExt hdr = {static_cast<uint32_t>(ext->m_ext_id), static_cast<uint32_t>(len)};
+      memcpy(buffer.data() + size, &hdr, sizeof(hdr));
+      size += sizeof(hdr) + len;
+   }
+   return true;
+}
 
-   if (ret == FLOW_FLUSH_WITH_REINSERT) {
-      FlowRecord *flow = m_flow_table[flow_index];
-      flow->m_flow.end_reason = FLOW_END_FORCED;
-      ipx_ring_push(m_export_queue, &flow->m_flow);
+/**
+ * \brief Create extensions saved by save_exts.
+ * \param [out] ok False when the data is damaged or an extension cannot be restored.
+ * \return List of extensions, nullptr when there are none or on failure.
+ */
+RecordExt *NHTFlowCache::load_exts(const uint8_t *data, size_t size, bool &ok) const
+{
+   Record rec;
+   ok = true;
+   while (size) {
+      SnapshotExt hdr;
+      if (size < sizeof(hdr)) {
+         ok = false;
+         break;
+      }
+      memcpy(&hdr, data, sizeof(hdr));
+      data += sizeof(hdr);
+      size -= sizeof(hdr);
+      RecordExt *ext = hdr.size <= size ? create_extension(hdr.id) : nullptr;
+      if (ext == nullptr) {
+         ok = false;
+         break;
+      }
+      rec.add_extension(ext);
+      if (!ext->load(data, hdr.size)) {
+         ok = false;
+         break;
+      }
+      data += hdr.size;
+      size -= hdr.size;
+   }
+   if (!ok) {
+      return nullptr;
+   }
+   RecordExt *exts = rec.m_exts;
+   rec.m_exts = nullptr;
+   return exts;
+}
 
-      std::swap(m_flow_table[flow_index], m_flow_table[m_cache_size + m_qidx]);
+/**
+ * \brief Get hash of names of process plugins in their order and of the number of registered extensions.
+ * Extension IDs of saved flows are valid only when it matches.
+ */
+uint64_t NHTFlowCache::plugins_hash() const
+{
+   uint64_t hash = 14695981039346656037ULL;
+   auto add = [&hash](const std::string &str) {
+      for (char c : str) {
+         hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+      }
+      hash = (hash ^ 0xff) * 1099511628211ULL;
+   };
+   for (uint32_t i = 0; i < get_plugin_cnt(); i++) {
+      add(get_plugin(i)->get_name());
+   }
+   add(std::to_string(get_extension_cnt()));
+   return hash;
+}
 
-      flow = m_flow_table[flow_index];
-      flow->m_flow.remove_extensions();
-      *flow = *m_flow_table[m_cache_size + m_qidx];
-      m_qidx = (m_qidx + 1) % m_qsize;
+/**
+ * \brief Write flows to the snapshot file and remove them from the cache.
+ * File is written under temporary name and renamed, so that a partial snapshot is never restored.
+ * \return True when the snapshot was written.
+ */
+bool NHTFlowCache::save_snapshot()
+{
+   std::string tmp_path = m_snapshot + ".tmp";
+   int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   FILE *file = fd < 0 ? nullptr : fdopen(fd, "w");
+   if (file == nullptr) {
+      std::cerr << "cache: unable to create snapshot " << tmp_path << ": " << strerror(errno) << std::endl;
+      if (fd >= 0) {
+         ::close(fd);
+      }
+      return false;
+   }
 
-      flow->m_flow.m_exts = nullptr;
+   SnapshotHeader header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+   header.version = SNAPSHOT_VERSION;
+   header.record_size = sizeof(SnapshotRecord);
+   header.key_fields = m_key_fields;
+   header.split_biflow = m_split_biflow;
+   header.rx_hash = static_cast<uint8_t>(m_rx_hash_min);
+   header.sampling = m_sampling;
+   header.plugins = plugins_hash();
+
+   // Header is written again with the number of records at the end
+   bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+   uint64_t skipped = 0;
+   save_table(m_v4, file, header.count, skipped, ok);
+   save_table(m_v6, file, header.count, skipped, ok);
+   save_table(m_v4x, file, header.count, skipped, ok);
+   save_table(m_v6x, file, header.count, skipped, ok);
+   if (skipped) {
+      std::cerr << "cache: " << skipped << " flows with plugin extensions which cannot be saved, exporting them" << std::endl;
+   }
+
+   ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+   ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+   ok = fclose(file) == 0 && ok;
+   ok = ok && rename(tmp_path.c_str(), m_snapshot.c_str()) == 0;
+   if (!ok) {
+      // Saved flows were already removed from the cache, there is nothing else to do than to report it
+      std::cerr << "cache: unable to write snapshot " << m_snapshot << ": " << strerror(errno) << std::endl;
+      unlink(tmp_path.c_str());
+   }
+   return ok;
+}
+
+/**
+ * \brief Export flow restored from snapshot which cannot be stored in the cache.
+ * \param [in] exts Restored extensions of the flow, the flow takes them over.
+ */
+void NHTFlowCache::export_saved(const SnapshotRecord &saved, RecordExt *exts, uint8_t reason)
+{
+   FlowRecord *flow = take_record();
+   flow->erase();
+   Flow &dst = flow->m_meta->m_flow;
+   dst.time_first.tv_sec = saved.time_first_sec;
+   dst.time_first.tv_usec = saved.time_first_usec;
+   dst.time_last.tv_sec = saved.time_last_sec;
+   dst.time_last.tv_usec = saved.time_last_usec;
+   dst.src_bytes = saved.src_bytes;
+   dst.dst_bytes = saved.dst_bytes;
+   dst.src_packets = saved.src_packets;
+   dst.dst_packets = saved.dst_packets;
+   dst.src_tcp_flags = saved.src_tcp_flags;
+   dst.dst_tcp_flags = saved.dst_tcp_flags;
+   dst.ip_version = saved.ip_version;
+   dst.ip_proto = saved.ip_proto;
+   dst.src_port = saved.src_port;
+   dst.dst_port = saved.dst_port;
+   dst.src_ip = saved.src_ip;
+   dst.dst_ip = saved.dst_ip;
+   memcpy(dst.src_mac, saved.src_mac, sizeof(dst.src_mac));
+   memcpy(dst.dst_mac, saved.dst_mac, sizeof(dst.dst_mac));
+   if (exts != nullptr) {
+      dst.m_exts = exts;
+      plugins_pre_export(dst);
+   }
+   push_export(flow, reason);
+}
+
+/**
+ * \brief Add exported record to the burst pushed to the output queue.
+ */
+inline void NHTFlowCache::queue_export(Flow *flow)
+{
+   if (flow->deferred != nullptr) {
+      // Analytics worker finishes pre_export and pushes the record to the export queue
+      ipx_ring_push(m_analytics_queue, flow);
+      return;
+   }
+   m_export_burst[m_export_cnt++] = flow;
+   if (m_export_cnt == EXPORT_BURST) {
+      flush_exports();
+   }
+}
+
+/**
+ * \brief Push records waiting for a burst to the output queue.
+ */
+void NHTFlowCache::flush_exports()
+{
+   if (m_export_cnt) {
+      ipx_ring_push_burst(m_export_queue, reinterpret_cast<ipx_msg_t **>(m_export_burst), m_export_cnt);
+      m_export_cnt = 0;
+   }
+}
+
+/**
+ * \brief Export record taken from the pool which is not stored in any table.
+ */
+void NHTFlowCache::push_export(FlowRecord *flow, uint8_t reason)
+{
+   Flow &dst = flow->m_meta->m_flow;
+   dst.end_reason = reason;
+   dst.sampling_interval = m_sampling;
+   dst.release_queue = m_release;
+   m_stats.exported[reason]++;
+   queue_export(&dst);
+}
+
+/**
+ * \brief Set flow endpoints from a canonical key in orientation of the packet which created the flow.
+ */
+static void key_to_flow(const flow_key_v4_t &key, bool swapped, Flow &flow)
+{
+   flow.ip_version = IP::v4;
+   flow.ip_proto = key.proto;
+   flow.src_port = swapped ? key.dst_port : key.src_port;
+   flow.dst_port = swapped ? key.src_port : key.dst_port;
+   flow.src_ip.v4 = swapped ? key.dst_ip : key.src_ip;
+   flow.dst_ip.v4 = swapped ? key.src_ip : key.dst_ip;
+}
+
+static void key_to_flow(const flow_key_v6_t &key, bool swapped, Flow &flow)
+{
+   flow.ip_version = IP::v6;
+   flow.ip_proto = key.proto;
+   flow.src_port = swapped ? key.dst_port : key.src_port;
+   flow.dst_port = swapped ? key.src_port : key.dst_port;
+   memcpy(flow.src_ip.v6, swapped ? key.dst_ip : key.src_ip, sizeof(flow.src_ip.v6));
+   memcpy(flow.dst_ip.v6, swapped ? key.src_ip : key.dst_ip, sizeof(flow.dst_ip.v6));
+}
+
+template <typename Base>
+static void key_to_flow(const flow_key_ext_t<Base> &key, bool swapped, Flow &flow)
+{
+   key_to_flow(key.base, swapped, flow);
+}
+
+/**
+ * \brief Export first packet held by the admission filter as a flow of one packet. Process plugins do not see such flows.
+ */
+template <typename Key>
+void NHTFlowCache::export_first(AdmitEntry<Key> &first, uint8_t reason)
+{
+   FlowRecord *flow = take_record();
+   flow->erase();
+   Flow &dst = flow->m_meta->m_flow;
+   key_to_flow(first.m_key, first.m_swapped, dst);
+   dst.time_first = first.m_time;
+   dst.time_last = first.m_time;
+   dst.src_packets = 1;
+   dst.src_bytes = first.m_bytes;
+   dst.src_tcp_flags = first.m_tcp_flags;
+   memcpy(dst.src_mac, first.m_src_mac, sizeof(dst.src_mac));
+   memcpy(dst.dst_mac, first.m_dst_mac, sizeof(dst.dst_mac));
+   first.m_used = false;
+   push_export(flow, reason);
+}
+
+/**
+ * \brief Pass packet of a flow missing in the table through the admission filter. First packet of a flow
+ * is held in the filter, entry it replaces is exported.
+ * \param [out] first Held first packet, valid when the flow is admitted.
+ * \return True when the packet is second packet of a held flow and the flow should be created.
+ */
+template <typename Key>
+bool NHTFlowCache::admit(FlowTable<Key> &table, const Packet &pkt, const Key &key, uint64_t hash, bool swapped, AdmitEntry<Key> &first)
+{
+   AdmitEntry<Key> &entry = table.m_admit[hash & table.m_admit_mask];
+   if (entry.m_used) {
+      if (entry.m_hash == hash && !memcmp(&entry.m_key, &key, sizeof(Key)) &&
+         pkt.ts.tv_sec - entry.m_time.tv_sec < entry.m_inactive) {
+         first = entry;
+         entry.m_used = false;
+         return true;
+      }
+      export_first(entry, pkt.ts.tv_sec - entry.m_time.tv_sec >= entry.m_inactive ? FLOW_END_INACTIVE : FLOW_END_NO_RES);
+   }
+
+   entry.m_key = key;
+   entry.m_hash = hash;
+   entry.m_time = pkt.ts;
+   entry.m_bytes = pkt.ip_len;
+   entry.m_tcp_flags = pkt.ip_proto == IPPROTO_TCP ? pkt.tcp_flags : 0;
+   entry.m_swapped = swapped;
+   entry.m_used = true;
+   entry.m_inactive = get_timeout(pkt.ip_proto, pkt.src_port, pkt.dst_port, entry.m_tcp_flags);
+   memcpy(entry.m_src_mac, pkt.src_mac, sizeof(entry.m_src_mac));
+   memcpy(entry.m_dst_mac, pkt.dst_mac, sizeof(entry.m_dst_mac));
+   return false;
+}
+
+/**
+ * \brief Add first packet held by the admission filter to the flow created by the second packet.
+ * First packet defines direction of the flow.
+ */
+template <typename Key>
+void NHTFlowCache::merge_admitted(FlowRecord *flow, const AdmitEntry<Key> &first, Packet &pkt, bool swapped)
+{
+   Flow &dst = flow->m_meta->m_flow;
+   dst.time_first = first.m_time;
+   memcpy(dst.src_mac, first.m_src_mac, sizeof(dst.src_mac));
+   memcpy(dst.dst_mac, first.m_dst_mac, sizeof(dst.dst_mac));
+   if (first.m_swapped == swapped) {
+      flow->m_src_packets++;
+      flow->m_src_bytes += first.m_bytes;
+      flow->m_src_tcp_flags |= first.m_tcp_flags;
+      return;
+   }
+
+   std::swap(dst.src_ip, dst.dst_ip);
+   std::swap(dst.src_port, dst.dst_port);
+   flow->m_dst_packets = flow->m_src_packets;
+   flow->m_dst_bytes = flow->m_src_bytes;
+   flow->m_dst_tcp_flags = flow->m_src_tcp_flags;
+   flow->m_src_packets = 1;
+   flow->m_src_bytes = first.m_bytes;
+   flow->m_src_tcp_flags = first.m_tcp_flags;
+   flow->m_swapped = first.m_swapped;
+   pkt.source_pkt = false;
+}
+
+/**
+ * \brief Export admission filter entries held for longer than their inactive timeout. Number of checked
+ * entries grows with elapsed time, so that the whole filter is swept within the shortest inactive timeout
+ * regardless of the packet rate.
+ */
+template <typename Key>
+void NHTFlowCache::sweep_admitted(FlowTable<Key> &table, time_t ts)
+{
+   uint64_t entries = static_cast<uint64_t>(table.m_admit_mask) + 1;
+   uint64_t count = ADMIT_SWEEP;
+   if (ts > table.m_admit_time) {
+      count += (entries * (ts - table.m_admit_time) + m_min_inactive - 1) / m_min_inactive;
+      table.m_admit_time = ts;
+   }
+   count = std::min(count, entries);
+   for (uint64_t i = 0; i < count; i++) {
+      AdmitEntry<Key> &entry = table.m_admit[table.m_admit_sweep];
+      table.m_admit_sweep = (table.m_admit_sweep + 1) & table.m_admit_mask;
+      if (entry.m_used && ts - entry.m_time.tv_sec >= entry.m_inactive) {
+         export_first(entry, FLOW_END_INACTIVE);
+      }
+   }
+}
+
+/**
+ * \brief Store flow from snapshot to its flow line, flows which do not fit are exported.
+ * \param [in] exts Restored extensions of the flow, the flow takes them over.
+ */
+template <typename Key>
+void NHTFlowCache::restore_flow(FlowTable<Key> &table, const SnapshotRecord &saved, RecordExt *exts)
+{
+   uint32_t line_index = get_line_index(table, saved.hash);
+   uint32_t flow_index = find_empty(table, line_index);
+   if (flow_index == line_index + m_line_size) {
+      export_saved(saved, exts, FLOW_END_NO_RES);
+      return;
+   }
+
+   FlowRecord *flow = table.m_flow_table[flow_index];
+   Flow &dst = flow->m_meta->m_flow;
+   flow->m_hash = saved.hash;
+   flow->m_time_last.tv_sec = saved.time_last_sec;
+   flow->m_time_last.tv_usec = saved.time_last_usec;
+   flow->m_src_bytes = saved.src_bytes;
+   flow->m_dst_bytes = saved.dst_bytes;
+   flow->m_src_packets = saved.src_packets;
+   flow->m_dst_packets = saved.dst_packets;
+   flow->m_src_tcp_flags = saved.src_tcp_flags;
+   flow->m_dst_tcp_flags = saved.dst_tcp_flags;
+   flow->m_swapped = saved.swapped;
+   dst.time_first.tv_sec = saved.time_first_sec;
+   dst.time_first.tv_usec = saved.time_first_usec;
+   dst.ip_version = saved.ip_version;
+   dst.ip_proto = saved.ip_proto;
+   dst.src_port = saved.src_port;
+   dst.dst_port = saved.dst_port;
+   dst.src_ip = saved.src_ip;
+   dst.dst_ip = saved.dst_ip;
+   memcpy(dst.src_mac, saved.src_mac, sizeof(dst.src_mac));
+   memcpy(dst.dst_mac, saved.dst_mac, sizeof(dst.dst_mac));
+   flow->m_inactive = get_timeout(dst.ip_proto, dst.src_port, dst.dst_port, saved.src_tcp_flags | saved.dst_tcp_flags);
+   flow->sync();
+   dst.m_exts = exts;
+
+   table.m_flow_tags[flow_index] = flow_tag(saved.hash);
+   memcpy(&table.m_flow_keys[flow_index], saved.key, sizeof(Key));
+   m_timeouts.schedule(flow->m_meta, get_expiration(flow));
+   m_stats.flows++;
+}
+
+/**
+ * \brief Restore flows from the snapshot file and remove the file. Flows are exported without their extensions
+ * when the snapshot was written with a different key layout, hashing or process plugins.
+ */
+void NHTFlowCache::load_snapshot()
+{
+   int fd = open(m_snapshot.c_str(), O_RDONLY);
+   if (fd < 0) {
+      if (errno != ENOENT) {
+         std::cerr << "cache: unable to open snapshot " << m_snapshot << ": " << strerror(errno) << std::endl;
+      }
+      return;
+   }
+   struct stat st;
+   void *mem = MAP_FAILED;
+   if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(SnapshotHeader)) {
+      mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   }
+   ::close(fd);
+   if (mem == MAP_FAILED) {
+      std::cerr << "cache: unable to map snapshot " << m_snapshot << std::endl;
+      return;
+   }
+
+   const SnapshotHeader *header = static_cast<const SnapshotHeader *>(mem);
+   size_t size = st.st_size;
+   if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) || header->version != SNAPSHOT_VERSION ||
+      header->record_size != sizeof(SnapshotRecord) ||
+      header->count > (size - sizeof(SnapshotHeader)) / sizeof(SnapshotRecord)) {
+      std::cerr << "cache: snapshot " << m_snapshot << " is not valid, ignoring it" << std::endl;
+      munmap(mem, size);
+      return;
+   }
+
+   // Records are followed by their extensions, find the end of each one before anything is restored
+   std::vector<const SnapshotRecord *> records;
+   const uint8_t *pos = reinterpret_cast<const uint8_t *>(header + 1);
+   const uint8_t *end = static_cast<const uint8_t *>(mem) + size;
+   time_t newest = 0;
+   for (uint64_t i = 0; i < header->count; i++) {
+      const SnapshotRecord *saved = reinterpret_cast<const SnapshotRecord *>(pos);
+      if (static_cast<size_t>(end - pos) < sizeof(SnapshotRecord) || saved->ext_size > end - pos - sizeof(SnapshotRecord)) {
+         break;
+      }
+      records.push_back(saved);
+      newest = max<time_t>(newest, saved->time_last_sec);
+      pos += sizeof(SnapshotRecord) + saved->ext_size;
+   }
+   if (records.size() != header->count) {
+      std::cerr << "cache: snapshot " << m_snapshot << " is not valid, ignoring it" << std::endl;
+      munmap(mem, size);
+      return;
+   }
+
+   bool compatible = header->key_fields == m_key_fields && header->split_biflow == m_split_biflow &&
+      header->rx_hash == static_cast<uint8_t>(m_rx_hash_min) && header->sampling == m_sampling &&
+      header->plugins == plugins_hash();
+   if (!compatible) {
+      std::cerr << "cache: snapshot " << m_snapshot << " was written with different flow key, sampling or process plugins, exporting its flows" << std::endl;
+   }
+
+   // Wheel time starts at the newest saved flow, timeouts which elapsed during restart expire with the first packet
+   m_timeouts.advance(newest);
+
+   uint64_t damaged = 0;
+   for (const SnapshotRecord *it : records) {
+      const SnapshotRecord &saved = *it;
+      bool ok = false;
+      // Extensions of other plugins would not be understood by outputs, their flows are exported without them
+      RecordExt *exts = compatible ? load_exts(reinterpret_cast<const uint8_t *>(it + 1), saved.ext_size, ok) : nullptr;
+      if (!ok) {
+         // Plugins expect their extensions in every flow they have seen, flow cannot stay in the cache without them
+         damaged += compatible;
+         export_saved(saved, nullptr, FLOW_END_FORCED);
+      } else if (saved.ip_version == IP::v4) {
+         if (m_key_fields) {
+            restore_flow(m_v4x, saved, exts);
+         } else {
+            restore_flow(m_v4, saved, exts);
+         }
+      } else if (m_key_fields) {
+         restore_flow(m_v6x, saved, exts);
+      } else {
+         restore_flow(m_v6, saved, exts);
+      }
+   }
+   if (damaged) {
+      std::cerr << "cache: unable to restore extensions of " << damaged << " flows from snapshot " << m_snapshot << ", exporting them" << std::endl;
+   }
+
+   munmap(mem, size);
+   unlink(m_snapshot.c_str());
+}
+
+template <typename Key>
+void NHTFlowCache::flush(FlowTable<Key> &table, Packet &pkt, size_t flow_index, int ret, bool source_flow)
+{
+   m_stats.flushed++;
+
+   if (ret == FLOW_FLUSH_WITH_REINSERT) {
+      FlowRecord *flow = table.m_flow_table[flow_index];
+      flow->sync();
+      flow->m_meta->m_flow.end_reason = FLOW_END_FORCED;
+      m_timeouts.cancel(flow->m_meta);
+
+      // Flow is copied to a record from the pool before it is exported, outputs can release it right after push
+      FlowRecord *exported = flow;
+      flow = table.m_flow_table[flow_index] = take_record();
+      flow->m_meta->m_flow.remove_extensions();
+      *flow = *exported;
+      exported->m_meta->m_flow.sampling_interval = m_sampling;
+      exported->m_meta->m_flow.release_queue = m_release;
+      queue_export(&exported->m_meta->m_flow);
+      m_stats.exported[FLOW_END_FORCED]++;
+
+      flow->m_meta->m_flow.m_exts = nullptr;
       flow->reuse(); // Clean counters, set time first to last
       flow->update(pkt, source_flow); // Set new counters from packet
+      flow->sync();
+      m_timeouts.schedule(flow->m_meta, get_expiration(flow));
 
-      ret = plugins_post_create(flow->m_flow, pkt);
+      ret = plugins_post_create(flow->m_meta->m_flow, pkt);
       if (ret & FLOW_FLUSH) {
-         flush(pkt, flow_index, ret, source_flow);
+         flush(table, pkt, flow_index, ret, source_flow);
       }
    } else {
-      m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_FORCED;
-      export_flow(flow_index);
+      table.m_flow_table[flow_index]->m_meta->m_flow.end_reason = FLOW_END_FORCED;
+      export_flow(table, flow_index);
    }
 }
 
-int NHTFlowCache::put_pkt(Packet &pkt)
+/**
+ * \brief Get hash of a flow key. Hash of input is reused when it is usable,
+ * ports and protocol are mixed into it, because NIC hashes often cover only addresses.
+ */
+template <typename Key>
+uint64_t NHTFlowCache::get_hash(const Packet &pkt, const Key &key) const
 {
-   int ret = plugins_pre_create(pkt);
+   if (m_rx_hash_min == RxHash::NONE || pkt.rx_hash_type < m_rx_hash_min) {
+      return XXH64(&key, sizeof(Key), 0);
+   }
+   uint64_t hash = (static_cast<uint64_t>(pkt.rx_hash) << 32) ^
+      (static_cast<uint64_t>(pkt.src_port ^ pkt.dst_port) << 8) ^ pkt.ip_proto ^ pkt.ip_version;
+   // Finalizer of MurmurHash3 spreads the bits to both line index and slot tag
+   hash ^= hash >> 33;
+   hash *= 0xff51afd7ed558ccdULL;
+   hash ^= hash >> 33;
+   hash *= 0xc4ceb9fe1a85ec53ULL;
+   hash ^= hash >> 33;
+   return hash;
+}
+
+/**
+ * \brief Check whether source endpoint of the packet orders after the destination one.
+ */
+static inline bool endpoints_swapped(const Packet &pkt)
+{
+   int cmp;
+   if (pkt.ip_version == IP::v4) {
+      cmp = (pkt.src_ip.v4 > pkt.dst_ip.v4) - (pkt.src_ip.v4 < pkt.dst_ip.v4);
+   } else {
+      cmp = memcmp(pkt.src_ip.v6, pkt.dst_ip.v6, sizeof(pkt.src_ip.v6));
+   }
+   return cmp > 0 || (cmp == 0 && pkt.src_port > pkt.dst_port);
+}
+
+/**
+ * \brief Create flow key of IPv4 packet. Biflow keys are canonical (lower endpoint first), so a single hash covers both directions.
+ */
+static inline void create_key(const Packet &pkt, bool swapped, flow_key_v4_t &key)
+{
+   key.proto = pkt.ip_proto;
+   key.src_port = swapped ? pkt.dst_port : pkt.src_port;
+   key.dst_port = swapped ? pkt.src_port : pkt.dst_port;
+   key.src_ip = swapped ? pkt.dst_ip.v4 : pkt.src_ip.v4;
+   key.dst_ip = swapped ? pkt.src_ip.v4 : pkt.dst_ip.v4;
+}
+
+/**
+ * \brief Create flow key of IPv6 packet. Biflow keys are canonical (lower endpoint first), so a single hash covers both directions.
+ */
+static inline void create_key(const Packet &pkt, bool swapped, flow_key_v6_t &key)
+{
+   key.proto = pkt.ip_proto;
+   key.src_port = swapped ? pkt.dst_port : pkt.src_port;
+   key.dst_port = swapped ? pkt.src_port : pkt.dst_port;
+   memcpy(key.src_ip, swapped ? pkt.dst_ip.v6 : pkt.src_ip.v6, sizeof(key.src_ip));
+   memcpy(key.dst_ip, swapped ? pkt.src_ip.v6 : pkt.dst_ip.v6, sizeof(key.dst_ip));
+}
+
+/**
+ * \brief Export flows which expired before the packet and continue running resizes.
+ */
+void NHTFlowCache::prepare_pkt(Packet &pkt)
+{
+   /* Export flows which expired before this packet, so that it never updates a timed out flow. */
+   expire_flows(pkt.ts.tv_sec);
+   if (m_v4.m_resize_size) {
+      resize_step(m_v4);
+   }
+   if (m_v6.m_resize_size) {
+      resize_step(m_v6);
+   }
+   if (m_v4x.m_resize_size) {
+      resize_step(m_v4x);
+   }
+   if (m_v6x.m_resize_size) {
+      resize_step(m_v6x);
+   }
+}
+
+void NHTFlowCache::compose_key(const Packet &pkt, bool swapped, flow_key_v4_t &key) const
+{
+   create_key(pkt, swapped, key);
+}
+
+void NHTFlowCache::compose_key(const Packet &pkt, bool swapped, flow_key_v6_t &key) const
+{
+   create_key(pkt, swapped, key);
+}
+
+/**
+ * \brief Create flow key with optional fields selected by the key option.
+ */
+template <typename Base>
+void NHTFlowCache::compose_key(const Packet &pkt, bool swapped, flow_key_ext_t<Base> &key) const
+{
+   create_key(pkt, swapped, key.base);
+   key.mpls_label = (m_key_fields & KEY_MPLS) ? pkt.mpls_label : 0;
+   key.vlan_id = (m_key_fields & KEY_VLAN) ? pkt.vlan_id : 0;
+   key.link_index = (m_key_fields & KEY_LINK) ? pkt.link_index : 0;
+}
+
+/**
+ * \brief Check whether flow with given hash is kept by flow sampling. Hash bits right below the slot tag
+ * are used, so sampled flows spread over all lines and tags. Canonical keys give both directions the same hash.
+ */
+inline bool NHTFlowCache::is_sampled(uint64_t hash) const
+{
+   return ((hash >> 25) & 0xffffffff) < m_sample_limit;
+}
+
+/**
+ * \brief Skip packet of a flow which is not sampled. Time still advances, but no lookup is done and no plugin sees the packet.
+ */
+void NHTFlowCache::skip_pkt(Packet &pkt)
+{
+   prepare_pkt(pkt);
+   m_stats.skipped++;
+}
+
+/**
+ * \brief Create flow key of a packet, compute its hash and prefetch its flow line when the flow is sampled.
+ * \return Hash of the key.
+ */
+template <typename Key>
+inline uint64_t NHTFlowCache::stage_key(const FlowTable<Key> &table, const Packet &pkt, bool swapped, Key &key) const
+{
+   compose_key(pkt, swapped, key);
+   uint64_t hash = get_hash(pkt, key);
+   if (is_sampled(hash)) {
+      prefetch_line(table, hash);
+   }
+   return hash;
+}
 
-   if (!create_hash_key(pkt)) { // saves key value and key length into attributes NHTFlowCache::key and NHTFlowCache::m_keylen
+template <typename Key>
+int NHTFlowCache::put_key(FlowTable<Key> &table, Packet &pkt, bool swapped)
+{
+   Key key;
+   compose_key(pkt, swapped, key);
+   uint64_t hash = get_hash(pkt, key);
+   if (!is_sampled(hash)) {
+      skip_pkt(pkt);
       return 0;
    }
+   return process_pkt(table, pkt, key, hash, swapped);
+}
 
-   uint64_t hashval = XXH64(m_key, m_keylen, 0); /* Calculates hash value from key created before. */
+int NHTFlowCache::put_pkt(Packet &pkt)
+{
+   bool swapped = !m_split_biflow && endpoints_swapped(pkt);
+   int ret = 0;
+   if (pkt.ip_version == IP::v4) {
+      ret = m_key_fields ? put_key(m_v4x, pkt, swapped) : put_key(m_v4, pkt, swapped);
+   } else if (pkt.ip_version == IP::v6) {
+      ret = m_key_fields ? put_key(m_v6x, pkt, swapped) : put_key(m_v6, pkt, swapped);
+   } else {
+      prepare_pkt(pkt);
+      plugins_pre_create(pkt);
+   }
+   flush_exports();
+   return ret;
+}
 
-   FlowRecord *flow; /* Pointer to flow we will be working with. */
-   bool found = false;
-   bool source_flow = true;
-   uint32_t line_index = hashval & m_line_mask; /* Get index of flow line. */
-   uint32_t flow_index = 0;
-   uint32_t next_line = line_index + m_line_size;
+template <typename Key>
+inline void NHTFlowCache::prefetch_line(const FlowTable<Key> &table, uint64_t hash) const
+{
+   uint32_t line_index = get_line_index(table, hash);
+   __builtin_prefetch(&table.m_flow_tags[line_index]);
+   __builtin_prefetch(&table.m_flow_table[line_index]);
+}
 
-   /* Find existing flow record in flow cache. */
-   for (flow_index = line_index; flow_index < next_line; flow_index++) {
-      if (m_flow_table[flow_index]->belongs(hashval)) {
-         found = true;
-         break;
-      }
+template <typename Key>
+inline void NHTFlowCache::prefetch_slot(const FlowTable<Key> &table, uint64_t hash) const
+{
+   uint32_t line_index = get_line_index(table, hash);
+   uint32_t mask = match_tags(&table.m_flow_tags[line_index], flow_tag(hash));
+   if (m_line_size < TAG_CHUNK) {
+      mask &= (static_cast<uint32_t>(1) << m_line_size) - 1;
+   }
+   if (mask) {
+      uint32_t flow_index = line_index + __builtin_ctz(mask);
+      __builtin_prefetch(&table.m_flow_keys[flow_index]);
+      __builtin_prefetch(table.m_flow_table[flow_index]);
    }
+}
 
-   /* Find inversed flow. */
-   if (!found && !m_split_biflow) {
-      uint64_t hashval_inv = XXH64(m_key_inv, m_keylen, 0);
-      uint64_t line_index_inv = hashval_inv & m_line_mask;
-      uint64_t next_line_inv = line_index_inv + m_line_size;
-      for (flow_index = line_index_inv; flow_index < next_line_inv; flow_index++) {
-         if (m_flow_table[flow_index]->belongs(hashval_inv)) {
-            found = true;
-            source_flow = false;
-            hashval = hashval_inv;
-            line_index = line_index_inv;
-            break;
+/**
+ * \brief Put packets into the cache in groups. Keys and hashes of a group are computed first and
+ * its flow lines are prefetched, then slot tags are probed and matching slots and records are
+ * prefetched, and only then packets are processed one by one. Memory stalls of lookups overlap this way.
+ */
+int NHTFlowCache::put_pkts(PacketBlock &block)
+{
+   for (size_t start = 0; start < block.cnt; start += PUT_PKTS_GROUP) {
+      uint32_t cnt = static_cast<uint32_t>(std::min<size_t>(block.cnt - start, PUT_PKTS_GROUP));
+      Packet *pkts = block.pkts + start;
+
+      for (uint32_t i = 0; i < cnt; i++) {
+         bool swapped = !m_split_biflow && endpoints_swapped(pkts[i]);
+         m_group[i].m_swapped = swapped;
+         m_group[i].m_ip_version = pkts[i].ip_version;
+         if (pkts[i].ip_version == IP::v4) {
+            m_group[i].m_hash = m_key_fields ? stage_key(m_v4x, pkts[i], swapped, m_group[i].m_key.m_v4x) :
+               stage_key(m_v4, pkts[i], swapped, m_group[i].m_key.m_v4);
+         } else if (pkts[i].ip_version == IP::v6) {
+            m_group[i].m_hash = m_key_fields ? stage_key(m_v6x, pkts[i], swapped, m_group[i].m_key.m_v6x) :
+               stage_key(m_v6, pkts[i], swapped, m_group[i].m_key.m_v6);
+         } else {
+            m_group[i].m_ip_version = 0;
+         }
+         if (m_group[i].m_ip_version && !is_sampled(m_group[i].m_hash)) {
+            m_group[i].m_ip_version = GROUP_SKIPPED;
+         }
+      }
+
+      for (uint32_t i = 0; i < cnt; i++) {
+         if (m_group[i].m_ip_version == IP::v4) {
+            if (m_key_fields) {
+               prefetch_slot(m_v4x, m_group[i].m_hash);
+            } else {
+               prefetch_slot(m_v4, m_group[i].m_hash);
+            }
+         } else if (m_group[i].m_ip_version == IP::v6) {
+            if (m_key_fields) {
+               prefetch_slot(m_v6x, m_group[i].m_hash);
+            } else {
+               prefetch_slot(m_v6, m_group[i].m_hash);
+            }
+         }
+      }
+
+      for (uint32_t i = 0; i < cnt; i++) {
+         const auto &key = m_group[i].m_key;
+         if (m_group[i].m_ip_version == IP::v4 && m_key_fields) {
+            process_pkt(m_v4x, pkts[i], key.m_v4x, m_group[i].m_hash, m_group[i].m_swapped);
+         } else if (m_group[i].m_ip_version == IP::v4) {
+            process_pkt(m_v4, pkts[i], key.m_v4, m_group[i].m_hash, m_group[i].m_swapped);
+         } else if (m_group[i].m_ip_version == IP::v6 && m_key_fields) {
+            process_pkt(m_v6x, pkts[i], key.m_v6x, m_group[i].m_hash, m_group[i].m_swapped);
+         } else if (m_group[i].m_ip_version == IP::v6) {
+            process_pkt(m_v6, pkts[i], key.m_v6, m_group[i].m_hash, m_group[i].m_swapped);
+         } else if (m_group[i].m_ip_version == GROUP_SKIPPED) {
+            skip_pkt(pkts[i]);
+         } else {
+            prepare_pkt(pkts[i]);
+            plugins_pre_create(pkts[i]);
          }
       }
    }
+   flush_exports();
+   return 0;
+}
+
+/**
+ * \brief Process packet in the flow table of its IP version.
+ * \param [in,out] table Flow table of the packet IP version.
+ * \param [in] pkt Input parsed packet.
+ * \param [in] key Flow key of the packet.
+ * \param [in] hashval Hash of the key.
+ * \param [in] swapped Endpoints of the packet are swapped in the key.
+ */
+template <typename Key>
+int NHTFlowCache::process_pkt(FlowTable<Key> &table, Packet &pkt, const Key &key, uint64_t hashval, bool swapped)
+{
+   prepare_pkt(pkt);
 
+   int ret = plugins_pre_create(pkt);
+
+   FlowRecord *flow; /* Pointer to flow we will be working with. */
+   bool found = false;
+   bool source_flow = true;
+   bool admitted = false;
+   AdmitEntry<Key> first;
+   uint8_t tag = flow_tag(hashval);
+   uint32_t line_index = get_line_index(table, hashval); /* Get index of flow line. */
+   uint32_t next_line = line_index + m_line_size;
+
+   /* Find existing flow record in flow cache. Biflow keys are canonical, so both directions share one line. */
+   uint32_t flow_index = find_flow(table, line_index, tag, key);
+   found = flow_index != next_line;
+
+   m_stats.lookups++;
    if (found) {
       /* Existing flow record was found, put flow record at the first index of flow line. */
-#ifdef FLOW_CACHE_STATS
-      m_lookups += (flow_index - line_index + 1);
-      m_lookups2 += (flow_index - line_index + 1) * (flow_index - line_index + 1);
-#endif /* FLOW_CACHE_STATS */
+      m_stats.hits++;
+      m_stats.probe_depth[probe_depth_bucket(flow_index - line_index + 1)]++;
 
-      flow = m_flow_table[flow_index];
-      for (decltype(flow_index) j = flow_index; j > line_index; j--) {
-         m_flow_table[j] = m_flow_table[j - 1];
+      /* Direction is recovered from orientation of the packet which created the flow. */
+      source_flow = table.m_flow_table[flow_index]->m_swapped == swapped;
+      if (m_eviction == EvictionPolicy::CLOCK) {
+         table.m_flow_table[flow_index]->m_referenced = true;
+      } else {
+         move_flow(table, flow_index, line_index);
+         flow_index = line_index;
       }
-
-      m_flow_table[line_index] = flow;
-      flow_index = line_index;
-#ifdef FLOW_CACHE_STATS
-      m_hits++;
-#endif /* FLOW_CACHE_STATS */
    } else {
-      /* Existing flow record was not found. Find free place in flow line. */
-      for (flow_index = line_index; flow_index < next_line; flow_index++) {
-         if (m_flow_table[flow_index]->is_empty()) {
-            found = true;
-            break;
+      if (table.m_admit != nullptr) {
+         if (!admit(table, pkt, key, hashval, swapped, first)) {
+            return 0;
          }
+         admitted = true;
       }
-      if (!found) {
+
+      /* Existing flow record was not found. Find free place in flow line. */
+      flow_index = find_empty(table, line_index);
+      if (flow_index == next_line) {
          /* If free place was not found (flow line is full), find
           * record which will be replaced by new record. */
-         flow_index = next_line - 1;
+         flow_index = find_victim(table, line_index);
 
          // Export flow
-         plugins_pre_export(m_flow_table[flow_index]->m_flow);
-         m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_NO_RES;
-         export_flow(flow_index);
+         flow = table.m_flow_table[flow_index];
+         flow->sync();
+         plugins_pre_export(flow->m_meta->m_flow);
+         flow->m_meta->m_flow.end_reason = FLOW_END_NO_RES;
+         export_flow(table, flow_index);
 
-#ifdef FLOW_CACHE_STATS
-         m_expired++;
-#endif /* FLOW_CACHE_STATS */
          uint32_t flow_new_index = line_index + m_line_new_idx;
-         flow = m_flow_table[flow_index];
-         for (decltype(flow_index) j = flow_index; j > flow_new_index; j--) {
-            m_flow_table[j] = m_flow_table[j - 1];
-         }
+         move_flow(table, flow_index, flow_new_index);
          flow_index = flow_new_index;
-         m_flow_table[flow_new_index] = flow;
-#ifdef FLOW_CACHE_STATS
-         m_not_empty++;
+         check_pressure(table, true);
       } else {
-         m_empty++;
-#endif /* FLOW_CACHE_STATS */
+         check_pressure(table, false);
+         m_stats.empty++;
       }
    }
 
    pkt.source_pkt = source_flow;
-   flow = m_flow_table[flow_index];
+   flow = table.m_flow_table[flow_index];
 
-   uint8_t flw_flags = source_flow ? flow->m_flow.src_tcp_flags : flow->m_flow.dst_tcp_flags;
+   uint8_t flw_flags = source_flow ? flow->m_src_tcp_flags : flow->m_dst_tcp_flags;
    if ((pkt.tcp_flags & 0x02) && (flw_flags & (0x01 | 0x04))) {
       // Flows with FIN or RST TCP flags are exported when new SYN packet arrives
-      m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_EOF;
-      export_flow(flow_index);
+      flow->m_meta->m_flow.end_reason = FLOW_END_EOF;
+      export_flow(table, flow_index);
       put_pkt(pkt);
       return 0;
    }
 
-   if (flow->is_empty()) {
+   if (table.m_flow_tags[flow_index] == FLOW_TAG_EMPTY) {
+      table.m_flow_tags[flow_index] = tag;
+      table.m_flow_keys[flow_index] = key;
       flow->create(pkt, hashval);
-      ret = plugins_post_create(flow->m_flow, pkt);
+      flow->m_swapped = swapped;
+      if (admitted) {
+         merge_admitted(flow, first, pkt, swapped);
+      }
+      const Flow &created = flow->m_meta->m_flow;
+      flow->m_inactive = get_timeout(created.ip_proto, created.src_port, created.dst_port,
+         flow->m_src_tcp_flags | flow->m_dst_tcp_flags);
+      m_stats.flows++;
+      m_timeouts.schedule(flow->m_meta, get_expiration(flow));
+      flow->sync();
+      ret = plugins_post_create(flow->m_meta->m_flow, pkt);
 
       if (ret & FLOW_FLUSH) {
-         export_flow(flow_index);
-#ifdef FLOW_CACHE_STATS
-         m_flushed++;
-#endif /* FLOW_CACHE_STATS */
+         flow->m_meta->m_flow.end_reason = FLOW_END_FORCED;
+         export_flow(table, flow_index);
+         m_stats.flushed++;
       }
    } else {
-      /* Check if flow record is expired (inactive timeout). */
-      if (pkt.ts.tv_sec - flow->m_flow.time_last.tv_sec >= m_inactive) {
-         m_flow_table[flow_index]->m_flow.end_reason = get_export_reason(flow->m_flow);
-         plugins_pre_export(flow->m_flow);
-         export_flow(flow_index);
-   #ifdef FLOW_CACHE_STATS
-         m_expired++;
-   #endif /* FLOW_CACHE_STATS */
-         return put_pkt(pkt);
-      }
-
-      /* Check if flow record is expired (active timeout). */
-      if (pkt.ts.tv_sec - flow->m_flow.time_first.tv_sec >= m_active) {
-         m_flow_table[flow_index]->m_flow.end_reason = FLOW_END_ACTIVE;
-         plugins_pre_export(flow->m_flow);
-         export_flow(flow_index);
-#ifdef FLOW_CACHE_STATS
-         m_expired++;
-#endif /* FLOW_CACHE_STATS */
+      /* Check if flow record is expired (inactive timeout). Active timeouts never elapse here,
+       * because the timing wheel is advanced to the packet time before lookup. */
+      if (pkt.ts.tv_sec - flow->m_time_last.tv_sec >= flow->m_inactive) {
+         flow->sync();
+         flow->m_meta->m_flow.end_reason = get_export_reason(flow);
+         plugins_pre_export(flow->m_meta->m_flow);
+         export_flow(table, flow_index);
          return put_pkt(pkt);
       }
 
-      ret = plugins_pre_update(flow->m_flow, pkt);
+      ret = plugins_pre_update(flow->m_meta->m_flow, pkt);
       if (ret & FLOW_FLUSH) {
-         flush(pkt, flow_index, ret, source_flow);
+         flush(table, pkt, flow_index, ret, source_flow);
          return 0;
       } else {
          flow->update(pkt, source_flow);
-         ret = plugins_post_update(flow->m_flow, pkt);
+         if (pkt.tcp_flags & (0x01 | 0x04)) {
+            check_linger(flow);
+         }
+         if (has_plugins()) {
+            /* Cold flow is kept up to date only when plugins can read it. */
+            flow->sync();
+            ret = plugins_post_update(flow->m_meta->m_flow, pkt);
+         }
 
          if (ret & FLOW_FLUSH) {
-            flush(pkt, flow_index, ret, source_flow);
+            flush(table, pkt, flow_index, ret, source_flow);
             return 0;
          }
       }
    }
 
-   export_expired(pkt.ts.tv_sec);
    return 0;
 }
 
-uint8_t NHTFlowCache::get_export_reason(Flow &flow)
+uint8_t NHTFlowCache::get_export_reason(const FlowRecord *flow)
 {
-   if ((flow.src_tcp_flags | flow.dst_tcp_flags) & (0x01 | 0x04)) {
+   if ((flow->m_src_tcp_flags | flow->m_dst_tcp_flags) & (0x01 | 0x04)) {
       // When FIN or RST is set, TCP connection ended naturally
       return FLOW_END_EOF;
    } else {
@@ -479,82 +1870,73 @@ uint8_t NHTFlowCache::get_export_reason(Flow &flow)
    }
 }
 
-void NHTFlowCache::export_expired(time_t ts)
+/**
+ * \brief Export flow record found by the timing wheel.
+ */
+template <typename Key>
+void NHTFlowCache::expire_flow(FlowTable<Key> &table, FlowRecord *flow)
 {
-   for (decltype(m_timeout_idx) i = m_timeout_idx; i < m_timeout_idx + m_line_new_idx; i++) {
-      if (!m_flow_table[i]->is_empty() && ts - m_flow_table[i]->m_flow.time_last.tv_sec >= m_inactive) {
-         m_flow_table[i]->m_flow.end_reason = get_export_reason(m_flow_table[i]->m_flow);
-         plugins_pre_export(m_flow_table[i]->m_flow);
-         export_flow(i);
-#ifdef FLOW_CACHE_STATS
-         m_expired++;
-#endif /* FLOW_CACHE_STATS */
-      }
-   }
-
-   m_timeout_idx = (m_timeout_idx + m_line_new_idx) & (m_cache_size - 1);
+   export_flow(table, find_record(table, flow));
 }
 
-bool NHTFlowCache::create_hash_key(Packet &pkt)
+void NHTFlowCache::export_expired(time_t ts)
 {
-   if (pkt.ip_version == IP::v4) {
-      struct flow_key_v4_t *key_v4 = reinterpret_cast<struct flow_key_v4_t *>(m_key);
-      struct flow_key_v4_t *key_v4_inv = reinterpret_cast<struct flow_key_v4_t *>(m_key_inv);
-
-      key_v4->proto = pkt.ip_proto;
-      key_v4->ip_version = IP::v4;
-      key_v4->src_port = pkt.src_port;
-      key_v4->dst_port = pkt.dst_port;
-      key_v4->src_ip = pkt.src_ip.v4;
-      key_v4->dst_ip = pkt.dst_ip.v4;
-
-      key_v4_inv->proto = pkt.ip_proto;
-      key_v4_inv->ip_version = IP::v4;
-      key_v4_inv->src_port = pkt.dst_port;
-      key_v4_inv->dst_port = pkt.src_port;
-      key_v4_inv->src_ip = pkt.dst_ip.v4;
-      key_v4_inv->dst_ip = pkt.src_ip.v4;
-
-      m_keylen = sizeof(flow_key_v4_t);
-      return true;
-   } else if (pkt.ip_version == IP::v6) {
-      struct flow_key_v6_t *key_v6 = reinterpret_cast<struct flow_key_v6_t *>(m_key);
-      struct flow_key_v6_t *key_v6_inv = reinterpret_cast<struct flow_key_v6_t *>(m_key_inv);
+   expire_flows(ts);
+   flush_exports();
+}
 
-      key_v6->proto = pkt.ip_proto;
-      key_v6->ip_version = IP::v6;
-      key_v6->src_port = pkt.src_port;
-      key_v6->dst_port = pkt.dst_port;
-      memcpy(key_v6->src_ip, pkt.src_ip.v6, sizeof(pkt.src_ip.v6));
-      memcpy(key_v6->dst_ip, pkt.dst_ip.v6, sizeof(pkt.dst_ip.v6));
+/**
+ * \brief Export flows whose timeouts elapsed, exported records may wait for a burst.
+ */
+void NHTFlowCache::expire_flows(time_t ts)
+{
+   m_timeouts.advance(ts);
+   if (m_v4.m_admit != nullptr) {
+      sweep_admitted(m_v4, ts);
+      sweep_admitted(m_v6, ts);
+   } else if (m_v4x.m_admit != nullptr) {
+      sweep_admitted(m_v4x, ts);
+      sweep_admitted(m_v6x, ts);
+   }
 
-      key_v6_inv->proto = pkt.ip_proto;
-      key_v6_inv->ip_version = IP::v6;
-      key_v6_inv->src_port = pkt.dst_port;
-      key_v6_inv->dst_port = pkt.src_port;
-      memcpy(key_v6_inv->src_ip, pkt.dst_ip.v6, sizeof(pkt.dst_ip.v6));
-      memcpy(key_v6_inv->dst_ip, pkt.src_ip.v6, sizeof(pkt.src_ip.v6));
+   TimerNode *node;
+   while ((node = m_timeouts.pop_expired()) != nullptr) {
+      FlowRecord *flow = static_cast<FlowMeta *>(node)->m_hot;
+      time_t expire = get_expiration(flow);
+      if (expire > ts) {
+         /* Flow was updated after it was scheduled, deadlines are re-checked only when they elapse. */
+         m_timeouts.schedule(flow->m_meta, expire);
+         continue;
+      }
 
-      m_keylen = sizeof(flow_key_v6_t);
-      return true;
+      flow->sync();
+      if (ts >= flow->m_time_last.tv_sec + flow->m_inactive) {
+         flow->m_meta->m_flow.end_reason = get_export_reason(flow);
+      } else {
+         flow->m_meta->m_flow.end_reason = FLOW_END_ACTIVE;
+      }
+      plugins_pre_export(flow->m_meta->m_flow);
+      if (flow->m_meta->m_flow.ip_version == IP::v4) {
+         if (m_key_fields) {
+            expire_flow(m_v4x, flow);
+         } else {
+            expire_flow(m_v4, flow);
+         }
+      } else {
+         if (m_key_fields) {
+            expire_flow(m_v6x, flow);
+         } else {
+            expire_flow(m_v6, flow);
+         }
+      }
    }
-
-   return false;
 }
 
-#ifdef FLOW_CACHE_STATS
-void NHTFlowCache::print_report()
+bool NHTFlowCache::get_stats(CacheStats &stats) const
 {
-   float tmp = float(m_lookups) / m_hits;
-
-   cout << "Hits: " << m_hits << endl;
-   cout << "Empty: " << m_empty << endl;
-   cout << "Not empty: " << m_not_empty << endl;
-   cout << "Expired: " << m_expired << endl;
-   cout << "Flushed: " << m_flushed << endl;
-   cout << "Average Lookup:  " << tmp << endl;
-   cout << "Variance Lookup: " << float(m_lookups2) / m_hits - tmp * tmp << endl;
+   stats = m_stats;
+   stats.size = m_v4.m_cache_size + m_v6.m_cache_size + m_v4x.m_cache_size + m_v6x.m_cache_size;
+   return true;
 }
-#endif /* FLOW_CACHE_STATS */
 
 }
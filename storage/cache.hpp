@@ -48,19 +48,26 @@
 #define IPXP_STORAGE_CACHE_HPP
 
 #include <string>
+#include <cstring>
+#include <vector>
+#include <utility>
+#include <cstdio>
+#include <netinet/in.h>
 
 #include <ipfixprobe/storage.hpp>
 #include <ipfixprobe/options.hpp>
 #include <ipfixprobe/flowifc.hpp>
 #include <ipfixprobe/utils.hpp>
 
+#include "timerwheel.hpp"
+#include "memory.hpp"
+
 namespace ipxp {
 
 struct __attribute__((packed)) flow_key_v4_t {
    uint16_t src_port;
    uint16_t dst_port;
    uint8_t proto;
-   uint8_t ip_version;
    uint32_t src_ip;
    uint32_t dst_ip;
 };
@@ -69,12 +76,95 @@ struct __attribute__((packed)) flow_key_v6_t {
    uint16_t src_port;
    uint16_t dst_port;
    uint8_t proto;
-   uint8_t ip_version;
    uint8_t src_ip[16];
    uint8_t dst_ip[16];
 };
 
-#define MAX_KEY_LENGTH (max<size_t>(sizeof(flow_key_v4_t), sizeof(flow_key_v6_t)))
+/**
+ * \brief Optional flow key fields selected by the key option.
+ */
+enum KeyField : uint8_t {
+   KEY_VLAN = 0x01, /**< Outer VLAN ID */
+   KEY_MPLS = 0x02, /**< Top MPLS label */
+   KEY_LINK = 0x04 /**< Index of input which received the packet */
+};
+
+/**
+ * \brief Flow key extended by optional fields. Fields not selected by the key option are zero.
+ */
+template <typename Base>
+struct __attribute__((packed)) flow_key_ext_t {
+   Base base;
+   uint32_t mpls_label;
+   uint16_t vlan_id;
+   uint16_t link_index;
+};
+
+/**
+ * \brief Flow saved in a snapshot file, followed by ext_size bytes of its saved plugin extensions.
+ */
+struct __attribute__((packed)) SnapshotRecord {
+   uint64_t hash;
+   int64_t time_first_sec;
+   int64_t time_first_usec;
+   int64_t time_last_sec;
+   int64_t time_last_usec;
+   uint64_t src_bytes;
+   uint64_t dst_bytes;
+   uint32_t src_packets;
+   uint32_t dst_packets;
+   uint8_t src_tcp_flags;
+   uint8_t dst_tcp_flags;
+   uint8_t ip_version;
+   uint8_t ip_proto;
+   uint16_t src_port;
+   uint16_t dst_port;
+   ipaddr_t src_ip;
+   ipaddr_t dst_ip;
+   uint8_t src_mac[6];
+   uint8_t dst_mac[6];
+   uint8_t swapped;
+   uint8_t key[sizeof(flow_key_ext_t<flow_key_v6_t>)]; /**< Key stored in the flow table. */
+   uint32_t ext_size; /**< Size of saved extensions following the record. */
+};
+
+/**
+ * \brief Plugin extension saved in a snapshot file, followed by size bytes written by RecordExt::save.
+ */
+struct __attribute__((packed)) SnapshotExt {
+   uint32_t id;
+   uint32_t size;
+};
+
+/**
+ * \brief Header of a snapshot file, followed by count records. Flows are restored only when
+ * the key layout, hashing and process plugins match the running cache.
+ */
+struct SnapshotHeader {
+   char magic[8];
+   uint32_t version;
+   uint32_t record_size;
+   uint64_t count;
+   uint8_t key_fields;
+   uint8_t split_biflow;
+   uint8_t rx_hash;
+   uint8_t reserved;
+   uint32_t sampling;
+   uint64_t plugins; /**< Hash of process plugins, identifies extension IDs of saved flows. */
+};
+
+/**
+ * \brief Tag of an empty slot, tags of occupied slots have the most significant bit set.
+ */
+#define FLOW_TAG_EMPTY 0x00
+
+/**
+ * \brief Get compact slot tag from flow hash. Line index uses low bits, tag uses the top ones.
+ */
+static inline uint8_t flow_tag(uint64_t hash)
+{
+   return static_cast<uint8_t>(hash >> 57) | 0x80;
+}
 
 #ifdef IPXP_FLOW_CACHE_SIZE
 static const uint32_t DEFAULT_FLOW_CACHE_SIZE = IPXP_FLOW_CACHE_SIZE;
@@ -90,6 +180,85 @@ static const uint32_t DEFAULT_FLOW_LINE_SIZE = 4; // 16 records per line
 
 static const uint32_t DEFAULT_INACTIVE_TIMEOUT = 30;
 static const uint32_t DEFAULT_ACTIVE_TIMEOUT = 300;
+static const uint32_t DEFAULT_GROW_RATIO = 5; // percent of new flows which evicted another flow
+static const uint32_t RESIZE_LINES_PER_PKT = 2;
+static const int NUMA_NODE_AUTO = -2;
+static const uint32_t PUT_PKTS_GROUP = 16; // packets whose flow lines are prefetched together
+static const time_t EXPORT_POOL_TIMEOUT = 10; // seconds to wait for outputs to release an exported record
+static const uint32_t DEFAULT_PROTECT_PACKETS = 10;
+static const uint32_t DEFAULT_EXPORT_POOL = 8192; // records exported and not yet released by outputs
+static const uint32_t ADMIT_SWEEP = 2; // admission filter entries checked for timeout per export_expired call at least
+static const uint32_t EXPORT_BURST = 32; // exported records pushed to the output queue at once
+static const uint8_t GROUP_SKIPPED = 0xff; // put_pkts group entry of a packet whose flow is not sampled
+
+/**
+ * \brief Usage of packet hashes provided by input.
+ */
+enum class RxHashMode {
+   OFF, /**< Always hash flow keys. */
+   AUTO, /**< Use symmetric input hashes, asymmetric ones only when biflows are split. */
+   FORCE /**< Use every input hash, input is known to produce symmetric hashes. */
+};
+
+/**
+ * \brief Selection of flows evicted from full flow lines.
+ */
+enum class EvictionPolicy {
+   MIDPOINT, /**< Hits move to the line front, new flows are inserted to the middle, last flow is evicted. */
+   LRU, /**< Hits move to the line front, new flows are inserted to the front, last flow is evicted. */
+   CLOCK, /**< Hits only mark flows, last flow is evicted unless marked, marked flows get a second chance. */
+   PROTECT, /**< As MIDPOINT, but flows with more than protect packets are evicted only from lines full of them. */
+   OLDEST /**< Hits move to the line front, flow with the oldest last packet is evicted. */
+};
+
+/**
+ * \brief Inactive timeout of flows of one protocol, optionally only of flows with given port on either endpoint.
+ */
+struct TimeoutClass {
+   uint8_t proto;
+   bool any_port;
+   uint16_t port;
+   uint32_t timeout;
+};
+
+/**
+ * \brief Parse timeout class in PROTO[/PORT]:TIME format, PROTO is a name or a number.
+ */
+static inline bool parse_timeout_class(const std::string &str, TimeoutClass &cls)
+{
+   size_t colon = str.find(':');
+   if (colon == std::string::npos) {
+      return false;
+   }
+   std::string proto = str.substr(0, colon);
+   size_t slash = proto.find('/');
+   try {
+      cls.timeout = str2num<decltype(cls.timeout)>(str.substr(colon + 1));
+      cls.any_port = slash == std::string::npos;
+      cls.port = cls.any_port ? 0 : str2num<decltype(cls.port)>(proto.substr(slash + 1));
+   } catch (std::invalid_argument &e) {
+      return false;
+   }
+   proto = proto.substr(0, slash);
+   if (proto == "tcp") {
+      cls.proto = IPPROTO_TCP;
+   } else if (proto == "udp") {
+      cls.proto = IPPROTO_UDP;
+   } else if (proto == "icmp") {
+      cls.proto = IPPROTO_ICMP;
+   } else if (proto == "icmp6") {
+      cls.proto = IPPROTO_ICMPV6;
+   } else if (proto == "sctp") {
+      cls.proto = IPPROTO_SCTP;
+   } else {
+      try {
+         cls.proto = str2num<decltype(cls.proto)>(proto);
+      } catch (std::invalid_argument &e) {
+         return false;
+      }
+   }
+   return true;
+}
 
 static_assert(std::is_unsigned<decltype(DEFAULT_FLOW_CACHE_SIZE)>(), "Static checks of default cache sizes won't properly work without unsigned type.");
 static_assert(bitcount<decltype(DEFAULT_FLOW_CACHE_SIZE)>(-1) > DEFAULT_FLOW_CACHE_SIZE, "Flow cache size is too big to fit in variable!");
@@ -102,14 +271,32 @@ class CacheOptParser : public OptionsParser
 {
 public:
    uint32_t m_cache_size;
+   uint32_t m_max_size;
    uint32_t m_line_size;
    uint32_t m_active;
    uint32_t m_inactive;
+   uint32_t m_grow_ratio;
    bool m_split_biflow;
+   HugePages m_hugepages;
+   int m_numa_node;
+   EvictionPolicy m_eviction;
+   uint32_t m_protect;
+   RxHashMode m_rx_hash;
+   uint32_t m_v6_size;
+   uint8_t m_key_fields;
+   uint32_t m_export_pool;
+   std::string m_snapshot;
+   uint32_t m_admit_size;
+   uint32_t m_sampling;
+   std::vector<TimeoutClass> m_timeout_classes;
+   uint32_t m_linger;
 
    CacheOptParser() : OptionsParser("cache", "Storage plugin implemented as a hash table"),
-      m_cache_size(1 << DEFAULT_FLOW_CACHE_SIZE), m_line_size(1 << DEFAULT_FLOW_LINE_SIZE),
-      m_active(DEFAULT_ACTIVE_TIMEOUT), m_inactive(DEFAULT_INACTIVE_TIMEOUT), m_split_biflow(false)
+      m_cache_size(1 << DEFAULT_FLOW_CACHE_SIZE), m_max_size(0), m_line_size(1 << DEFAULT_FLOW_LINE_SIZE),
+      m_active(DEFAULT_ACTIVE_TIMEOUT), m_inactive(DEFAULT_INACTIVE_TIMEOUT), m_grow_ratio(DEFAULT_GROW_RATIO),
+      m_split_biflow(false), m_hugepages(HugePages::NONE), m_numa_node(-1), m_eviction(EvictionPolicy::MIDPOINT),
+      m_protect(DEFAULT_PROTECT_PACKETS), m_rx_hash(RxHashMode::AUTO), m_v6_size(0), m_key_fields(0),
+      m_export_pool(DEFAULT_EXPORT_POOL), m_admit_size(0), m_sampling(1), m_linger(0)
    {
       register_option("s", "size", "EXPONENT", "Cache size exponent to the power of two",
          [this](const char *arg){try {unsigned exp = str2num<decltype(exp)>(arg);
@@ -119,6 +306,29 @@ public:
                m_cache_size = static_cast<uint32_t>(1) << exp;
             } catch(std::invalid_argument &e) {return false;} return true;},
          OptionFlags::RequiredArgument);
+      register_option("6", "v6-size", "EXPONENT", "IPv6 table size exponent to the power of two (default: size exponent minus 2)",
+         [this](const char *arg){try {unsigned exp = str2num<decltype(exp)>(arg);
+               if (exp < 4 || exp > 30) {
+                  throw PluginError("IPv6 flow table size must be between 4 and 30");
+               }
+               m_v6_size = static_cast<uint32_t>(1) << exp;
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("m", "max-size", "EXPONENT", "Maximal cache size exponent, cache grows up to this size when flows are evicted too often and never shrinks (default: no growth)",
+         [this](const char *arg){try {unsigned exp = str2num<decltype(exp)>(arg);
+               if (exp < 4 || exp > 30) {
+                  throw PluginError("Flow cache maximal size must be between 4 and 30");
+               }
+               m_max_size = static_cast<uint32_t>(1) << exp;
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("g", "grow-ratio", "PERCENT", "Grow cache when more than PERCENT of new flows evict another flow",
+         [this](const char *arg){try {m_grow_ratio = str2num<decltype(m_grow_ratio)>(arg);
+               if (m_grow_ratio > 100) {
+                  throw PluginError("Flow cache grow ratio must be between 0 and 100");
+               }
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
       register_option("l", "line", "EXPONENT", "Cache line size exponent to the power of two",
          [this](const char *arg){try {m_line_size = static_cast<uint32_t>(1) << str2num<decltype(m_line_size)>(arg);
                if (m_line_size < 1) {
@@ -126,36 +336,235 @@ public:
                }
             } catch(std::invalid_argument &e) {return false;} return true;},
          OptionFlags::RequiredArgument);
+      register_option("e", "eviction", "POLICY", "Flow evicted from a full cache line: mid (default), lru, clock, protect or oldest",
+         [this](const char *arg){
+            if (!strcmp(arg, "mid")) {
+               m_eviction = EvictionPolicy::MIDPOINT;
+            } else if (!strcmp(arg, "lru")) {
+               m_eviction = EvictionPolicy::LRU;
+            } else if (!strcmp(arg, "clock")) {
+               m_eviction = EvictionPolicy::CLOCK;
+            } else if (!strcmp(arg, "protect")) {
+               m_eviction = EvictionPolicy::PROTECT;
+            } else if (!strcmp(arg, "oldest")) {
+               m_eviction = EvictionPolicy::OLDEST;
+            } else {
+               return false;
+            }
+            return true;},
+         OptionFlags::RequiredArgument);
+      register_option("P", "protect", "PACKETS", "Flows with more than PACKETS packets are protected by the protect eviction policy",
+         [this](const char *arg){try {m_protect = str2num<decltype(m_protect)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("r", "rxhash", "MODE", "Use packet hash of input instead of hashing flow keys: off, auto (default) or force",
+         [this](const char *arg){
+            if (!strcmp(arg, "off")) {
+               m_rx_hash = RxHashMode::OFF;
+            } else if (!strcmp(arg, "auto")) {
+               m_rx_hash = RxHashMode::AUTO;
+            } else if (!strcmp(arg, "force")) {
+               m_rx_hash = RxHashMode::FORCE;
+            } else {
+               return false;
+            }
+            return true;},
+         OptionFlags::RequiredArgument);
+      register_option("k", "key", "FIELDS", "Add fields to the flow key, comma separated list of vlan, mpls and link (index of input)",
+         [this](const char *arg){
+            m_key_fields = 0;
+            std::string fields(arg);
+            size_t begin = 0;
+            while (begin <= fields.size()) {
+               size_t end = fields.find(',', begin);
+               if (end == std::string::npos) {
+                  end = fields.size();
+               }
+               std::string field = fields.substr(begin, end - begin);
+               if (field == "vlan") {
+                  m_key_fields |= KEY_VLAN;
+               } else if (field == "mpls") {
+                  m_key_fields |= KEY_MPLS;
+               } else if (field == "link") {
+                  m_key_fields |= KEY_LINK;
+               } else {
+                  return false;
+               }
+               begin = end + 1;
+            }
+            return true;},
+         OptionFlags::RequiredArgument);
+      register_option("E", "export-pool", "RECORDS", "Number of records which can be exported and not yet released by outputs",
+         [this](const char *arg){try {m_export_pool = str2num<decltype(m_export_pool)>(arg);
+               if (m_export_pool < 1 || m_export_pool > (1U << 30)) {
+                  throw PluginError("Export pool size must be between 1 and 2^30");
+               }
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
       register_option("a", "active", "TIME", "Active timeout in seconds",
          [this](const char *arg){try {m_active = str2num<decltype(m_active)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
          OptionFlags::RequiredArgument);
       register_option("i", "inactive", "TIME", "Inactive timeout in seconds",
          [this](const char *arg){try {m_inactive = str2num<decltype(m_inactive)>(arg);} catch(std::invalid_argument &e) {return false;} return true;},
          OptionFlags::RequiredArgument);
+      register_option("t", "timeouts", "CLASSES", "Inactive timeouts of protocols and ports, comma separated list of PROTO[/PORT]:TIME, "
+         "PROTO is tcp, udp, icmp, icmp6, sctp or a number and PORT matches either endpoint",
+         [this](const char *arg){
+            m_timeout_classes.clear();
+            std::string classes(arg);
+            size_t begin = 0;
+            while (begin <= classes.size()) {
+               size_t end = classes.find(',', begin);
+               if (end == std::string::npos) {
+                  end = classes.size();
+               }
+               TimeoutClass cls;
+               if (!parse_timeout_class(classes.substr(begin, end - begin), cls)) {
+                  return false;
+               }
+               m_timeout_classes.push_back(cls);
+               begin = end + 1;
+            }
+            return true;},
+         OptionFlags::RequiredArgument);
+      register_option("L", "linger", "TIME", "Inactive timeout of TCP flows which have seen FIN or RST (default: off)",
+         [this](const char *arg){try {m_linger = str2num<decltype(m_linger)>(arg);
+               if (m_linger < 1) {
+                  throw PluginError("Linger timeout must be at least 1 second");
+               }
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("f", "admission", "EXPONENT", "Hold first packets of new flows in admission filter of given size exponent, flows get a record on their second packet (default: off)",
+         [this](const char *arg){try {unsigned exp = str2num<decltype(exp)>(arg);
+               if (exp < 4 || exp > 30) {
+                  throw PluginError("Admission filter size must be between 4 and 30");
+               }
+               m_admit_size = static_cast<uint32_t>(1) << exp;
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("R", "sampling", "N", "Keep only 1 out of N flows, flows are selected deterministically by hash of their key and packets of other flows are skipped (default: 1, all flows)",
+         [this](const char *arg){try {m_sampling = str2num<decltype(m_sampling)>(arg);
+               if (m_sampling < 1 || m_sampling > (1U << 24)) {
+                  throw PluginError("Sampling interval must be between 1 and 2^24");
+               }
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
+      register_option("w", "snapshot", "PATH", "Save flows to PATH.N (N is index of the cache) on exit instead of exporting them and restore them on start, configuration must not change in between. Flows with an extension of a process plugin which cannot save it are exported instead",
+         [this](const char *arg){m_snapshot = arg; return !m_snapshot.empty();},
+         OptionFlags::RequiredArgument);
       register_option("S", "split", "", "Split biflows into uniflows",
          [this](const char *arg){ m_split_biflow = true; return true;}, OptionFlags::NoArgument);
+      register_option("p", "hugepages", "PAGES", "Back cache arrays by hugepages: 0/off, 1/on (2M, fallback to THP), thp, 2M or 1G",
+         [this](const char *arg){return parse_hugepages(arg, m_hugepages);},
+         OptionFlags::RequiredArgument);
+      register_option("n", "numa", "NODE", "Bind cache memory to NUMA node, auto selects node of the CPU running cache initialization",
+         [this](const char *arg){if (!strcmp(arg, "auto")) {m_numa_node = NUMA_NODE_AUTO; return true;}
+            try {m_numa_node = str2num<decltype(m_numa_node)>(arg);
+               if (m_numa_node < 0 || m_numa_node >= 64) {
+                  throw PluginError("NUMA node must be between 0 and 63");
+               }
+            } catch(std::invalid_argument &e) {return false;} return true;},
+         OptionFlags::RequiredArgument);
    }
 };
 
-class FlowRecord
-{
-   uint64_t m_hash;
+class FlowRecord;
 
+/**
+ * \brief Cold part of flow record. Flow counters are valid only after FlowRecord::sync.
+ */
+class FlowMeta : public TimerNode
+{
 public:
+   FlowRecord *m_hot;
    Flow m_flow;
 
-   FlowRecord();
+   FlowMeta() : m_hot(nullptr)
+   {
+   }
+};
+
+/**
+ * \brief Hot part of flow record, holds everything which is accessed per packet in one cache line.
+ */
+class alignas(64) FlowRecord
+{
+public:
+   uint64_t m_hash;
+   struct timeval m_time_last;
+   uint64_t m_src_bytes;
+   uint64_t m_dst_bytes;
+   uint32_t m_src_packets;
+   uint32_t m_dst_packets;
+   uint8_t m_src_tcp_flags;
+   uint8_t m_dst_tcp_flags;
+   bool m_swapped; /**< Endpoints of the packet which created the flow were swapped in the canonical key */
+   bool m_referenced; /**< Flow was hit since it was last passed by the clock eviction policy */
+   uint32_t m_inactive; /**< Inactive timeout of the flow class, linger timeout once TCP FIN or RST was seen. */
+   FlowMeta *m_meta;
+
+   FlowRecord(FlowMeta *meta);
    ~FlowRecord();
+   FlowRecord(const FlowRecord &other) = delete;
+   FlowRecord &operator=(const FlowRecord &other);
 
    void erase();
    void reuse();
+   void sync();
 
-   inline bool is_empty() const;
-   inline bool belongs(uint64_t pkt_hash) const;
    void create(const Packet &pkt, uint64_t pkt_hash);
    void update(const Packet &pkt, bool src);
 };
 
+static_assert(sizeof(FlowRecord) == 64, "Hot flow record must fit in one cache line!");
+
+/**
+ * \brief First packet of a flow held by the admission filter until the flow shows a second packet.
+ */
+template <typename Key>
+struct AdmitEntry {
+   Key m_key;
+   uint64_t m_hash;
+   struct timeval m_time;
+   uint16_t m_bytes;
+   uint8_t m_tcp_flags;
+   bool m_swapped;
+   bool m_used;
+   uint32_t m_inactive;
+   uint8_t m_src_mac[6];
+   uint8_t m_dst_mac[6];
+};
+
+/**
+ * \brief Slot arrays and resize state of a flow table. Each IP version has its own table,
+ * so keys are compared and hashed with a size known at compile time.
+ */
+template <typename Key>
+struct FlowTable {
+   FlowRecord **m_flow_table;
+   uint8_t *m_flow_tags;
+   Key *m_flow_keys;
+   uint32_t m_cache_size;
+   uint32_t m_max_size;
+   uint32_t m_line_mask;
+   uint32_t m_resize_size; /**< Size of the table before resize, 0 when resize is not running. */
+   uint32_t m_split_idx; /**< Lines of the table before resize below this index are already split. */
+   uint32_t m_old_line_mask;
+   uint32_t m_window_inserts;
+   uint32_t m_window_evictions;
+   FlowRecord *m_resize_records;
+   FlowMeta *m_resize_meta;
+   AdmitEntry<Key> *m_admit; /**< Direct mapped admission filter, nullptr when every flow is admitted. */
+   uint32_t m_admit_mask;
+   uint32_t m_admit_sweep; /**< Next admission entry checked for inactive timeout. */
+   time_t m_admit_time; /**< Time of the last admission filter sweep. */
+
+   FlowTable() : m_flow_table(nullptr), m_flow_tags(nullptr), m_flow_keys(nullptr), m_cache_size(0), m_max_size(0),
+      m_line_mask(0), m_resize_size(0), m_split_idx(0), m_old_line_mask(0), m_window_inserts(0), m_window_evictions(0),
+      m_resize_records(nullptr), m_resize_meta(nullptr), m_admit(nullptr), m_admit_mask(0), m_admit_sweep(0), m_admit_time(0)
+   {
+   }
+};
+
 class NHTFlowCache : public StoragePlugin
 {
 public:
@@ -163,48 +572,141 @@ public:
    ~NHTFlowCache();
    void init(const char *params);
    void close();
-   void set_queue(ipx_ring_t *queue);
    OptionsParser *get_parser() const { return new CacheOptParser(); }
    std::string get_name() const { return "cache"; }
 
    int put_pkt(Packet &pkt);
+   int put_pkts(PacketBlock &block);
    void export_expired(time_t ts);
+   bool get_stats(CacheStats &stats) const;
 
 private:
-   uint32_t m_cache_size;
    uint32_t m_line_size;
-   uint32_t m_line_mask;
    uint32_t m_line_new_idx;
-   uint32_t m_qsize;
-   uint32_t m_qidx;
-   uint32_t m_timeout_idx;
-#ifdef FLOW_CACHE_STATS
-   uint64_t m_empty;
-   uint64_t m_not_empty;
-   uint64_t m_hits;
-   uint64_t m_expired;
-   uint64_t m_flushed;
-   uint64_t m_lookups;
-   uint64_t m_lookups2;
-#endif /* FLOW_CACHE_STATS */
+   uint32_t m_pool_size;
+   uint32_t m_spare_cnt;
+   uint32_t m_grow_ratio;
+   EvictionPolicy m_eviction;
+   uint32_t m_protect;
+   RxHash m_rx_hash_min; /**< Weakest kind of input hash used as flow hash, NONE when input hashes are not used. */
+   CacheStats m_stats; /**< Counters are written only by the thread owning the cache, published copies are taken by get_stats. */
    uint32_t m_active;
    uint32_t m_inactive;
+   uint32_t m_linger; /**< Linger timeout of closed TCP flows, maximum when not used. */
+   uint32_t m_proto_timeout[256]; /**< Inactive timeouts by IP protocol. */
+   std::vector<TimeoutClass> m_port_timeouts; /**< Timeout classes limited to a port, checked before protocol ones. */
+   uint32_t m_min_inactive; /**< Shortest inactive timeout of any flow, admission filter is swept within it. */
    bool m_split_biflow;
-   uint8_t m_keylen;
-   char m_key[MAX_KEY_LENGTH];
-   char m_key_inv[MAX_KEY_LENGTH];
-   FlowRecord **m_flow_table;
-   FlowRecord *m_flow_records;
+   struct {
+      uint64_t m_hash;
+      uint8_t m_ip_version; /**< IP version of the key, 0 when no key can be created for the packet, GROUP_SKIPPED when flow is not sampled. */
+      bool m_swapped;
+      union {
+         flow_key_v4_t m_v4;
+         flow_key_v6_t m_v6;
+         flow_key_ext_t<flow_key_v4_t> m_v4x;
+         flow_key_ext_t<flow_key_v6_t> m_v6x;
+      } m_key;
+   } m_group[PUT_PKTS_GROUP]; /**< Keys of packets processed by put_pkts. */
+   FlowTable<flow_key_v4_t> m_v4;
+   FlowTable<flow_key_v6_t> m_v6;
+   FlowTable<flow_key_ext_t<flow_key_v4_t>> m_v4x; /**< Tables used instead of m_v4 and m_v6 when key has optional fields. */
+   FlowTable<flow_key_ext_t<flow_key_v6_t>> m_v6x;
+   uint8_t m_key_fields;
+   uint32_t m_sampling; /**< Flow sampling interval, 1 when all flows are kept. */
+   uint64_t m_sample_limit; /**< Flows whose hash bits below the slot tag are less than the limit are sampled. */
+   FlowRecord **m_flow_spare; /**< Stack of records swapped with exported ones. */
+   SPSCRing<Flow *> *m_release; /**< Exported records released by outputs. */
+   bool m_pool_stalled; /**< Outputs stopped releasing records, remaining flows are dropped at finish. */
+   ptrdiff_t m_flow_offset; /**< Offset of flow in its cold record, offsetof is not usable with virtual members. */
+   Flow *m_export_burst[EXPORT_BURST]; /**< Exported records not pushed to the output queue yet. */
+   uint32_t m_export_cnt;
+   std::string m_snapshot; /**< Path of snapshot file, empty when flows are not saved on exit. */
+   MemoryPolicy m_memory;
+   std::vector<std::pair<void *, size_t>> m_mappings; /**< Memory mappings of cache arrays and record chunks. */
+   TimerWheel m_timeouts;
 
-   void flush(Packet &pkt, size_t flow_index, int ret, bool source_flow);
-   bool create_hash_key(Packet &pkt);
-   void export_flow(size_t index);
-   static uint8_t get_export_reason(Flow &flow);
+   template <typename Key>
+   void init_table(FlowTable<Key> &table, uint32_t size, uint32_t max_size, uint32_t admit_size, const char *name);
+   template <typename Key>
+   void close_table(FlowTable<Key> &table);
+   template <typename Key>
+   uint32_t find_flow(const FlowTable<Key> &table, uint32_t line_index, uint8_t tag, const Key &key) const;
+   template <typename Key>
+   uint32_t find_empty(const FlowTable<Key> &table, uint32_t line_index) const;
+   template <typename Key>
+   void move_flow(FlowTable<Key> &table, uint32_t from, uint32_t to);
+   template <typename Key>
+   uint32_t find_victim(FlowTable<Key> &table, uint32_t line_index);
+   template <typename Key>
+   uint32_t get_line_index(const FlowTable<Key> &table, uint64_t hash) const;
+   template <typename Key>
+   uint32_t find_record(const FlowTable<Key> &table, const FlowRecord *flow) const;
+   template <typename Key>
+   void check_pressure(FlowTable<Key> &table, bool evicted);
+   template <typename Key>
+   void start_resize(FlowTable<Key> &table);
+   template <typename Key>
+   void split_line(FlowTable<Key> &table, uint32_t line_index);
+   template <typename Key>
+   void resize_step(FlowTable<Key> &table);
+   template <typename Key>
+   void prefetch_line(const FlowTable<Key> &table, uint64_t hash) const;
+   template <typename Key>
+   void prefetch_slot(const FlowTable<Key> &table, uint64_t hash) const;
+   template <typename Key>
+   uint64_t get_hash(const Packet &pkt, const Key &key) const;
+   template <typename Base>
+   void compose_key(const Packet &pkt, bool swapped, flow_key_ext_t<Base> &key) const;
+   void compose_key(const Packet &pkt, bool swapped, flow_key_v4_t &key) const;
+   void compose_key(const Packet &pkt, bool swapped, flow_key_v6_t &key) const;
+   bool is_sampled(uint64_t hash) const;
+   void skip_pkt(Packet &pkt);
+   template <typename Key>
+   uint64_t stage_key(const FlowTable<Key> &table, const Packet &pkt, bool swapped, Key &key) const;
+   template <typename Key>
+   int put_key(FlowTable<Key> &table, Packet &pkt, bool swapped);
+   template <typename Key>
+   int process_pkt(FlowTable<Key> &table, Packet &pkt, const Key &key, uint64_t hashval, bool swapped);
+   template <typename Key>
+   void flush(FlowTable<Key> &table, Packet &pkt, size_t flow_index, int ret, bool source_flow);
+   template <typename Key>
+   void export_flow(FlowTable<Key> &table, size_t index);
+   template <typename Key>
+   void finish_table(FlowTable<Key> &table);
+   template <typename Key>
+   void expire_flow(FlowTable<Key> &table, FlowRecord *flow);
+   template <typename Key>
+   void save_table(FlowTable<Key> &table, FILE *file, uint64_t &count, uint64_t &skipped, bool &ok);
+   bool save_exts(const Flow &flow, std::vector<uint8_t> &buffer, size_t &size) const;
+   RecordExt *load_exts(const uint8_t *data, size_t size, bool &ok) const;
+   uint64_t plugins_hash() const;
+   template <typename Key>
+   void restore_flow(FlowTable<Key> &table, const SnapshotRecord &saved, RecordExt *exts);
+   void export_saved(const SnapshotRecord &saved, RecordExt *exts, uint8_t reason);
+   void push_export(FlowRecord *flow, uint8_t reason);
+   void queue_export(Flow *flow);
+   void flush_exports();
+   void expire_flows(time_t ts);
+   template <typename Key>
+   bool admit(FlowTable<Key> &table, const Packet &pkt, const Key &key, uint64_t hash, bool swapped, AdmitEntry<Key> &first);
+   template <typename Key>
+   void merge_admitted(FlowRecord *flow, const AdmitEntry<Key> &first, Packet &pkt, bool swapped);
+   template <typename Key>
+   void export_first(AdmitEntry<Key> &first, uint8_t reason);
+   template <typename Key>
+   void sweep_admitted(FlowTable<Key> &table, time_t ts);
+   bool save_snapshot();
+   void load_snapshot();
+   FlowRecord *take_record();
+   void *alloc_array(size_t size, const char *name);
+   bool alloc_records(uint32_t count, FlowRecord *&records, FlowMeta *&meta);
+   void prepare_pkt(Packet &pkt);
+   time_t get_expiration(const FlowRecord *flow) const;
+   uint32_t get_timeout(uint8_t proto, uint16_t src_port, uint16_t dst_port, uint8_t tcp_flags) const;
+   void check_linger(FlowRecord *flow);
+   static uint8_t get_export_reason(const FlowRecord *flow);
    void finish();
-
-#ifdef FLOW_CACHE_STATS
-   void print_report();
-#endif /* FLOW_CACHE_STATS */
 };
 
 }
@@ -0,0 +1,185 @@
+/**
+ * \file memory.cpp
+ * \brief Allocation of large flow cache arrays backed by hugepages and bound to NUMA node
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "memory.hpp"
+
+namespace ipxp {
+
+static const size_t PAGE_2M = static_cast<size_t>(1) << 21;
+static const size_t PAGE_1G = static_cast<size_t>(1) << 30;
+
+bool parse_hugepages(const char *str, HugePages &pages)
+{
+   std::string arg(str);
+   if (arg == "0" || arg == "off") {
+      pages = HugePages::NONE;
+   } else if (arg == "1" || arg == "on" || arg == "auto") {
+      pages = HugePages::AUTO;
+   } else if (arg == "thp") {
+      pages = HugePages::THP;
+   } else if (arg == "2M" || arg == "2m") {
+      pages = HugePages::SIZE_2M;
+   } else if (arg == "1G" || arg == "1g") {
+      pages = HugePages::SIZE_1G;
+   } else {
+      return false;
+   }
+   return true;
+}
+
+int get_current_numa_node()
+{
+   unsigned cpu;
+   unsigned node;
+   if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+      return -1;
+   }
+   return static_cast<int>(node);
+}
+
+static size_t round_up(size_t size, size_t align)
+{
+   return (size + align - 1) & ~(align - 1);
+}
+
+/**
+ * \brief Bind memory range to NUMA node. Must be called before the pages are touched.
+ */
+static bool bind_memory(void *mem, size_t size, int node, const std::string &name)
+{
+   unsigned long mask = 1UL << node;
+   if (syscall(SYS_mbind, mem, size, MPOL_BIND, &mask, sizeof(mask) * 8, 0) != 0) {
+      std::cerr << "cache: unable to bind " << name << " to NUMA node " << node << ": " << strerror(errno) << std::endl;
+      return false;
+   }
+   return true;
+}
+
+static void *map_hugetlb(size_t &size, size_t page, int page_shift)
+{
+   size_t map_size = round_up(size, page);
+   void *mem = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT), -1, 0);
+   if (mem == MAP_FAILED) {
+      return nullptr;
+   }
+   size = map_size;
+   return mem;
+}
+
+/**
+ * \brief Map regular pages aligned to 2M, so that transparent hugepages can back the whole range.
+ */
+static void *map_aligned(size_t &size)
+{
+   size_t map_size = round_up(size, PAGE_2M);
+   void *mem = mmap(nullptr, map_size + PAGE_2M, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   if (mem == MAP_FAILED) {
+      return nullptr;
+   }
+
+   uintptr_t start = reinterpret_cast<uintptr_t>(mem);
+   uintptr_t aligned = round_up(start, PAGE_2M);
+   if (aligned != start) {
+      munmap(mem, aligned - start);
+   }
+   munmap(reinterpret_cast<void *>(aligned + map_size), start + PAGE_2M - aligned);
+   size = map_size;
+   return reinterpret_cast<void *>(aligned);
+}
+
+void *map_memory(size_t &size, MemoryPolicy &policy, const std::string &name)
+{
+   void *mem = nullptr;
+   HugePages &pages = policy.m_hugepages;
+
+   if (pages == HugePages::SIZE_1G) {
+      mem = map_hugetlb(size, PAGE_1G, 30);
+      if (mem == nullptr) {
+         std::cerr << "cache: 1G hugepages unavailable for " << name << ", trying 2M hugepages" << std::endl;
+         pages = HugePages::SIZE_2M;
+      }
+   }
+   if (mem == nullptr && (pages == HugePages::SIZE_2M || pages == HugePages::AUTO)) {
+      mem = map_hugetlb(size, PAGE_2M, 21);
+      if (mem == nullptr) {
+         std::cerr << "cache: 2M hugepages unavailable for " << name << ", using transparent hugepages" << std::endl;
+         pages = HugePages::THP;
+      }
+   }
+   if (mem == nullptr && pages == HugePages::THP) {
+      mem = map_aligned(size);
+      if (mem != nullptr && madvise(mem, size, MADV_HUGEPAGE) != 0) {
+         std::cerr << "cache: transparent hugepages unavailable for " << name << ", using regular pages" << std::endl;
+         pages = HugePages::NONE;
+      }
+   }
+   if (mem == nullptr) {
+      mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      mem = mem == MAP_FAILED ? nullptr : mem;
+   }
+   if (mem == nullptr) {
+      return nullptr;
+   }
+
+   if (policy.m_numa_node >= 0) {
+      bind_memory(mem, size, policy.m_numa_node, name);
+   }
+   return mem;
+}
+
+void unmap_memory(void *mem, size_t size)
+{
+   munmap(mem, size);
+}
+
+}
@@ -0,0 +1,106 @@
+/**
+ * \file memory.hpp
+ * \brief Allocation of large flow cache arrays backed by hugepages and bound to NUMA node
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+#ifndef IPXP_STORAGE_MEMORY_HPP
+#define IPXP_STORAGE_MEMORY_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace ipxp {
+
+/**
+ * \brief Backing pages of mapped memory.
+ */
+enum class HugePages {
+   NONE, /**< Regular pages. */
+   AUTO, /**< Explicit 2M hugepages, then transparent hugepages, then regular pages. */
+   THP, /**< Transparent hugepages. */
+   SIZE_2M, /**< Explicit 2M hugepages, fallback as AUTO. */
+   SIZE_1G /**< Explicit 1G hugepages, fallback as AUTO. */
+};
+
+/**
+ * \brief Parse hugepages option value.
+ * \param [in] str One of 0, off, 1, on, auto, thp, 2M, 1G.
+ * \param [out] pages Parsed value.
+ * \return True on success.
+ */
+bool parse_hugepages(const char *str, HugePages &pages);
+
+/**
+ * \brief Get NUMA node of the CPU the calling thread runs on.
+ * \return Node number or -1 when unknown.
+ */
+int get_current_numa_node();
+
+/**
+ * \brief Memory placement settings.
+ */
+struct MemoryPolicy {
+   HugePages m_hugepages;
+   int m_numa_node; /**< Node to bind memory to, -1 for no binding. */
+
+   MemoryPolicy() : m_hugepages(HugePages::NONE), m_numa_node(-1)
+   {
+   }
+};
+
+/**
+ * \brief Map anonymous zeroed memory according to policy.
+ *
+ * Regular and transparent hugepage mappings do not reserve memory, only touched pages are allocated.
+ * Explicit hugepage mappings are reserved as a whole. Fallbacks are reported to stderr and stored
+ * in the policy, so that following allocations do not retry unavailable page sizes.
+ * \param [in,out] size Requested size, rounded up to the page size of the mapping on success.
+ * \param [in,out] policy Placement settings.
+ * \param [in] name Name of the array used in reports.
+ * \return Pointer to memory or nullptr on failure.
+ */
+void *map_memory(size_t &size, MemoryPolicy &policy, const std::string &name);
+
+/**
+ * \brief Unmap memory returned by map_memory.
+ */
+void unmap_memory(void *mem, size_t size);
+
+}
+#endif /* IPXP_STORAGE_MEMORY_HPP */
@@ -0,0 +1,148 @@
+/**
+ * \file timerwheel.cpp
+ * \brief Hierarchical timing wheel used for flow expiration
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include "timerwheel.hpp"
+
+namespace ipxp {
+
+TimerWheel::TimerWheel() : m_now(0), m_count(0)
+{
+   for (unsigned i = 0; i < SLOTS; i++) {
+      m_slots[i].m_tw_prev = &m_slots[i];
+      m_slots[i].m_tw_next = &m_slots[i];
+   }
+   m_expired.m_tw_prev = &m_expired;
+   m_expired.m_tw_next = &m_expired;
+}
+
+/**
+ * \brief Get list head of the slot for given expiration time relative to wheel time.
+ */
+TimerNode *TimerWheel::get_slot(time_t expire)
+{
+   if (expire < m_now) {
+      expire = m_now;
+   }
+   uint64_t delta = expire - m_now;
+   if (delta < L0_SLOTS) {
+      return &m_slots[expire & (L0_SLOTS - 1)];
+   }
+
+   unsigned shift = L0_BITS;
+   unsigned level = 1;
+   for (; level < LEVELS - 1; level++, shift += LN_BITS) {
+      if (delta < (static_cast<uint64_t>(1) << (shift + LN_BITS))) {
+         break;
+      }
+   }
+   if (level == LEVELS - 1 && delta >= (static_cast<uint64_t>(1) << (shift + LN_BITS))) {
+      // Out of wheel range, node is re-cascaded on the top level until its deadline is in range
+      expire = m_now + (static_cast<time_t>(1) << (shift + LN_BITS)) - 1;
+   }
+   return &m_slots[L0_SLOTS + (level - 1) * LN_SLOTS + ((expire >> shift) & (LN_SLOTS - 1))];
+}
+
+/**
+ * \brief Move all nodes from one list to the end of another list.
+ */
+void TimerWheel::splice(TimerNode *to, TimerNode *from)
+{
+   if (from->m_tw_next == from) {
+      return;
+   }
+   TimerNode *first = from->m_tw_next;
+   TimerNode *last = from->m_tw_prev;
+
+   first->m_tw_prev = to->m_tw_prev;
+   to->m_tw_prev->m_tw_next = first;
+   last->m_tw_next = to;
+   to->m_tw_prev = last;
+
+   from->m_tw_prev = from;
+   from->m_tw_next = from;
+}
+
+/**
+ * \brief Redistribute nodes of the current slot of given level to lower levels.
+ */
+void TimerWheel::cascade(unsigned level)
+{
+   unsigned shift = L0_BITS + (level - 1) * LN_BITS;
+   TimerNode *slot = &m_slots[L0_SLOTS + (level - 1) * LN_SLOTS + ((m_now >> shift) & (LN_SLOTS - 1))];
+   TimerNode tmp;
+   tmp.m_tw_prev = &tmp;
+   tmp.m_tw_next = &tmp;
+
+   // Detach the slot first, clamped nodes may be linked back to the same slot
+   splice(&tmp, slot);
+   while (tmp.m_tw_next != &tmp) {
+      TimerNode *node = tmp.m_tw_next;
+      unlink(node);
+      link(get_slot(node->m_tw_expire), node);
+   }
+}
+
+void TimerWheel::advance(time_t now)
+{
+   while (m_now <= now) {
+      if (m_count == 0) {
+         // Nothing is scheduled, wheel time can jump
+         m_now = now + 1;
+         return;
+      }
+
+      if (!(m_now & (L0_SLOTS - 1))) {
+         unsigned level = 1;
+         while (level < LEVELS - 1 && !(m_now & ((static_cast<time_t>(1) << (L0_BITS + level * LN_BITS)) - 1))) {
+            level++;
+         }
+         for (; level >= 1; level--) {
+            cascade(level);
+         }
+      }
+
+      splice(&m_expired, &m_slots[m_now & (L0_SLOTS - 1)]);
+      m_now++;
+   }
+}
+
+}
@@ -0,0 +1,196 @@
+/**
+ * \file timerwheel.hpp
+ * \brief Hierarchical timing wheel used for flow expiration
+ * \date 2026
+ */
+/*
+ * Copyright (C) 2026 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+#ifndef IPXP_STORAGE_TIMERWHEEL_HPP
+#define IPXP_STORAGE_TIMERWHEEL_HPP
+
+#include <cstdint>
+#include <ctime>
+
+namespace ipxp {
+
+/**
+ * \brief Intrusive link of an object scheduled in TimerWheel.
+ *
+ * Links are never copied, copy of a scheduled node is not scheduled.
+ */
+class TimerNode
+{
+   friend class TimerWheel;
+
+   TimerNode *m_tw_prev;
+   TimerNode *m_tw_next;
+   time_t m_tw_expire;
+
+public:
+   TimerNode() : m_tw_prev(nullptr), m_tw_next(nullptr), m_tw_expire(0)
+   {
+   }
+   TimerNode(const TimerNode &other) : TimerNode()
+   {
+   }
+   TimerNode &operator=(const TimerNode &other)
+   {
+      return *this;
+   }
+
+   /**
+    * \brief Check whether the node is linked in a timing wheel.
+    */
+   bool is_scheduled() const
+   {
+      return m_tw_prev != nullptr;
+   }
+
+   /**
+    * \brief Get time at which the node was scheduled to expire.
+    */
+   time_t get_expire() const
+   {
+      return m_tw_expire;
+   }
+};
+
+/**
+ * \brief Hierarchical timing wheel with one second resolution.
+ *
+ * First level has 256 one second slots, each next level has 64 slots covering
+ * whole previous level. Nodes from higher levels are cascaded down when their slot
+ * becomes current, so cost of advancing the wheel depends on number of scheduled
+ * nodes rather than on number of stored objects. Deadlines further than the wheel
+ * range are clamped, caller is expected to re-check deadline of each expired node.
+ */
+class TimerWheel
+{
+public:
+   TimerWheel();
+   TimerWheel(const TimerWheel &other) = delete;
+   TimerWheel &operator=(const TimerWheel &other) = delete;
+
+   /**
+    * \brief Schedule node to expire at given time.
+    *
+    * Wheel time is initialized by the first call of advance.
+    * \param [in] node Node which is not scheduled yet.
+    * \param [in] expire Expiration time in seconds.
+    */
+   void schedule(TimerNode *node, time_t expire)
+   {
+      node->m_tw_expire = expire;
+      link(get_slot(expire), node);
+      m_count++;
+   }
+
+   /**
+    * \brief Remove node from the wheel, does nothing when node is not scheduled.
+    */
+   void cancel(TimerNode *node)
+   {
+      if (node->is_scheduled()) {
+         unlink(node);
+         m_count--;
+      }
+   }
+
+   /**
+    * \brief Move all nodes with expiration time lower or equal to given time to expired list.
+    * \param [in] now Current time in seconds.
+    */
+   void advance(time_t now);
+
+   /**
+    * \brief Take next node from expired list.
+    * \return Expired node or nullptr when expired list is empty.
+    */
+   TimerNode *pop_expired()
+   {
+      TimerNode *node = m_expired.m_tw_next;
+      if (node == &m_expired) {
+         return nullptr;
+      }
+      unlink(node);
+      m_count--;
+      return node;
+   }
+
+   /**
+    * \brief Get number of scheduled and expired nodes.
+    */
+   uint32_t size() const
+   {
+      return m_count;
+   }
+
+private:
+   static const unsigned L0_BITS = 8;
+   static const unsigned LN_BITS = 6;
+   static const unsigned LEVELS = 4;
+   static const unsigned L0_SLOTS = 1 << L0_BITS;
+   static const unsigned LN_SLOTS = 1 << LN_BITS;
+   static const unsigned SLOTS = L0_SLOTS + (LEVELS - 1) * LN_SLOTS;
+
+   TimerNode m_slots[SLOTS]; /**< Heads of circular slot lists. */
+   TimerNode m_expired; /**< Head of expired nodes list. */
+   time_t m_now; /**< Next tick which will be processed. */
+   uint32_t m_count;
+
+   TimerNode *get_slot(time_t expire);
+   void cascade(unsigned level);
+   static void splice(TimerNode *to, TimerNode *from);
+
+   static void link(TimerNode *head, TimerNode *node)
+   {
+      node->m_tw_prev = head->m_tw_prev;
+      node->m_tw_next = head;
+      head->m_tw_prev->m_tw_next = node;
+      head->m_tw_prev = node;
+   }
+   static void unlink(TimerNode *node)
+   {
+      node->m_tw_prev->m_tw_next = node->m_tw_next;
+      node->m_tw_next->m_tw_prev = node->m_tw_prev;
+      node->m_tw_prev = nullptr;
+      node->m_tw_next = nullptr;
+   }
+};
+
+}
+#endif /* IPXP_STORAGE_TIMERWHEEL_HPP */
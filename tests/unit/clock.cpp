@@ -0,0 +1,51 @@
+#include <unistd.h>
+#include "gtest/gtest.h"
+
+#include <ipfixprobe/clock.hpp>
+
+namespace ipxp_test {
+
+using ipxp::CoarseClock;
+
+static int64_t usec(const struct timeval &tv)
+{
+   return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+static int64_t nsec(const struct timespec &ts)
+{
+   return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+TEST(clock, system_without_ticker) {
+   struct timeval tv;
+   gettimeofday(&tv, nullptr);
+   EXPECT_LE(usec(tv), usec(CoarseClock::now()));
+   EXPECT_LE(tv.tv_sec, CoarseClock::seconds());
+}
+
+TEST(clock, ticker_advances) {
+   CoarseClock::start(1000);
+   struct timeval tv;
+   gettimeofday(&tv, nullptr);
+   struct timespec first = CoarseClock::monotonic();
+   // Value published at start is at most one tick old
+   EXPECT_LE(usec(tv) - usec(CoarseClock::now()), 1000000);
+
+   usleep(50000);
+   struct timespec second = CoarseClock::monotonic();
+   EXPECT_GT(nsec(second), nsec(first));
+   EXPECT_GE(usec(CoarseClock::now()), usec(tv));
+   CoarseClock::stop();
+
+   EXPECT_LE(nsec(second), nsec(CoarseClock::monotonic()));
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   // invoking the tests
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,129 @@
+#include "gtest/gtest.h"
+
+#include "ipfixprobe/flowifc.hpp"
+#include "../../process/basicplus.hpp"
+#include "../../process/pstats.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+template<typename T>
+T *restore(const RecordExt &ext, size_t size)
+{
+   std::vector<uint8_t> buffer(size);
+   int len = ext.save(buffer.data(), buffer.size());
+   EXPECT_GT(len, 0);
+   if (len <= 0) {
+      return nullptr;
+   }
+
+   RecordExt *copy = create_extension(ext.m_ext_id);
+   EXPECT_NE(nullptr, copy);
+   if (copy == nullptr) {
+      return nullptr;
+   }
+   EXPECT_EQ(ext.m_ext_id, copy->m_ext_id);
+   EXPECT_TRUE(copy->load(buffer.data(), len));
+   return static_cast<T *>(copy);
+}
+
+TEST(create_extension, unknown_id) {
+   EXPECT_EQ(nullptr, create_extension(-1));
+   EXPECT_EQ(nullptr, create_extension(get_extension_cnt()));
+}
+
+TEST(basicplus, round_trip) {
+   RecordExtBASICPLUS ext;
+   ext.ip_ttl[0] = 64;
+   ext.ip_ttl[1] = 128;
+   ext.ip_flg[0] = 2;
+   ext.tcp_win[0] = 1000;
+   ext.tcp_win[1] = 2000;
+   ext.tcp_opt[0] = 0x4;
+   ext.tcp_mss[0] = 1460;
+   ext.tcp_syn_size = 44;
+   ext.dst_filled = true;
+
+   RecordExtBASICPLUS *copy = restore<RecordExtBASICPLUS>(ext, 64);
+   ASSERT_NE(nullptr, copy);
+   EXPECT_EQ(64, copy->ip_ttl[0]);
+   EXPECT_EQ(128, copy->ip_ttl[1]);
+   EXPECT_EQ(2, copy->ip_flg[0]);
+   EXPECT_EQ(0, copy->ip_flg[1]);
+   EXPECT_EQ(1000, copy->tcp_win[0]);
+   EXPECT_EQ(2000, copy->tcp_win[1]);
+   EXPECT_EQ(0x4u, copy->tcp_opt[0]);
+   EXPECT_EQ(0u, copy->tcp_opt[1]);
+   EXPECT_EQ(1460u, copy->tcp_mss[0]);
+   EXPECT_EQ(44, copy->tcp_syn_size);
+   EXPECT_TRUE(copy->dst_filled);
+   delete copy;
+}
+
+TEST(basicplus, invalid_size) {
+   RecordExtBASICPLUS ext;
+   uint8_t buffer[64];
+   EXPECT_EQ(-1, ext.save(buffer, 34));
+   ASSERT_EQ(35, ext.save(buffer, sizeof(buffer)));
+   EXPECT_FALSE(ext.load(buffer, 34));
+   EXPECT_FALSE(ext.load(buffer, 36));
+}
+
+TEST(pstats, round_trip) {
+   RecordExtPSTATS ext;
+   for (uint16_t i = 0; i < 5; i++) {
+      ext.pkt_sizes[i] = 100 + i;
+      ext.pkt_tcp_flgs[i] = 0x10 | i;
+      ext.pkt_timestamps[i].tv_sec = 1000 + i;
+      ext.pkt_timestamps[i].tv_usec = 500 * i;
+      ext.pkt_dirs[i] = i % 2 ? -1 : 1;
+   }
+   ext.pkt_count = 5;
+   ext.tcp_seq[0] = 123456;
+   ext.tcp_ack[1] = 654321;
+   ext.tcp_len[0] = 10;
+   ext.tcp_flg[1] = 0x18;
+
+   RecordExtPSTATS *copy = restore<RecordExtPSTATS>(ext, ext.saved_size());
+   ASSERT_NE(nullptr, copy);
+   ASSERT_EQ(5, copy->pkt_count);
+   for (uint16_t i = 0; i < 5; i++) {
+      EXPECT_EQ(ext.pkt_sizes[i], copy->pkt_sizes[i]);
+      EXPECT_EQ(ext.pkt_tcp_flgs[i], copy->pkt_tcp_flgs[i]);
+      EXPECT_EQ(ext.pkt_timestamps[i].tv_sec, copy->pkt_timestamps[i].tv_sec);
+      EXPECT_EQ(ext.pkt_timestamps[i].tv_usec, copy->pkt_timestamps[i].tv_usec);
+      EXPECT_EQ(ext.pkt_dirs[i], copy->pkt_dirs[i]);
+   }
+   EXPECT_EQ(123456u, copy->tcp_seq[0]);
+   EXPECT_EQ(654321u, copy->tcp_ack[1]);
+   EXPECT_EQ(10, copy->tcp_len[0]);
+   EXPECT_EQ(0x18, copy->tcp_flg[1]);
+   delete copy;
+}
+
+TEST(pstats, invalid_size) {
+   RecordExtPSTATS ext;
+   ext.pkt_count = 3;
+   std::vector<uint8_t> buffer(ext.saved_size());
+   EXPECT_EQ(-1, ext.save(buffer.data(), buffer.size() - 1));
+   ASSERT_EQ((int) buffer.size(), ext.save(buffer.data(), buffer.size()));
+
+   RecordExtPSTATS copy;
+   EXPECT_FALSE(copy.load(buffer.data(), buffer.size() - 1));
+   EXPECT_EQ(0, copy.pkt_count);
+
+   uint16_t count = PSTATS_MAXELEMCOUNT + 1;
+   memcpy(buffer.data(), &count, sizeof(count));
+   EXPECT_FALSE(copy.load(buffer.data(), buffer.size()));
+   EXPECT_EQ(0, copy.pkt_count);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   // invoking the tests
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
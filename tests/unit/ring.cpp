@@ -0,0 +1,117 @@
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include <ipfixprobe/ring.h>
+
+namespace ipxp_test {
+
+static void *msg(uintptr_t value)
+{
+   return reinterpret_cast<void *>(value);
+}
+
+TEST(ring, size_is_power_of_two) {
+   ipx_ring_t *ring = ipx_ring_init(100, false);
+   ASSERT_NE(nullptr, ring);
+   EXPECT_EQ(128U, ipx_ring_size(ring));
+   ipx_ring_destroy(ring);
+}
+
+TEST(ring, burst_order) {
+   ipx_ring_t *ring = ipx_ring_init(16, false);
+   void *in[10];
+   void *out[16];
+   for (uintptr_t i = 0; i < 10; i++) {
+      in[i] = msg(i + 1);
+   }
+
+   ipx_ring_push_burst(ring, in, 10);
+   ipx_ring_push(ring, msg(11));
+   EXPECT_EQ(11U, ipx_ring_cnt(ring));
+
+   ASSERT_EQ(4U, ipx_ring_pop_burst(ring, out, 4));
+   for (uintptr_t i = 0; i < 4; i++) {
+      EXPECT_EQ(msg(i + 1), out[i]);
+   }
+   // Messages are counted until the next pop
+   EXPECT_EQ(11U, ipx_ring_cnt(ring));
+   ASSERT_EQ(7U, ipx_ring_pop_burst(ring, out, 16));
+   EXPECT_EQ(msg(5), out[0]);
+   EXPECT_EQ(msg(11), out[6]);
+   EXPECT_EQ(nullptr, ipx_ring_pop(ring));
+   EXPECT_EQ(0U, ipx_ring_cnt(ring));
+   ipx_ring_destroy(ring);
+}
+
+TEST(ring, wrap_around) {
+   ipx_ring_t *ring = ipx_ring_init(8, false);
+   void *out[8];
+   uintptr_t next = 1;
+   uintptr_t expected = 1;
+   for (int round = 0; round < 100; round++) {
+      void *in[5];
+      for (int i = 0; i < 5; i++) {
+         in[i] = msg(next++);
+      }
+      ipx_ring_push_burst(ring, in, 5);
+      uint32_t cnt = ipx_ring_pop_burst(ring, out, 8);
+      ASSERT_EQ(5U, cnt);
+      for (uint32_t i = 0; i < cnt; i++) {
+         EXPECT_EQ(msg(expected++), out[i]);
+      }
+   }
+   ipx_ring_destroy(ring);
+}
+
+TEST(ring, multiple_writers) {
+   const uintptr_t writers = 4;
+   const uintptr_t count = 200000;
+   ipx_ring_t *ring = ipx_ring_init(256, true);
+
+   std::vector<std::thread> threads;
+   for (uintptr_t w = 0; w < writers; w++) {
+      threads.emplace_back([ring, w, count]() {
+         void *burst[7];
+         uintptr_t i = 0;
+         while (i < count) {
+            uint32_t n = 0;
+            while (n < 7 && i < count) {
+               burst[n++] = msg((w << 32 | i++) + 1);
+            }
+            ipx_ring_push_burst(ring, burst, n);
+         }
+      });
+   }
+
+   std::vector<uintptr_t> next(writers, 0);
+   uintptr_t received = 0;
+   void *out[32];
+   while (received < writers * count) {
+      uint32_t cnt = ipx_ring_pop_burst(ring, out, 32);
+      for (uint32_t i = 0; i < cnt; i++) {
+         uintptr_t value = reinterpret_cast<uintptr_t>(out[i]) - 1;
+         uintptr_t w = value >> 32;
+         ASSERT_LT(w, writers);
+         // Messages of one writer keep their order
+         ASSERT_EQ(next[w], value & 0xffffffff);
+         next[w]++;
+      }
+      received += cnt;
+   }
+   for (auto &thread : threads) {
+      thread.join();
+   }
+   EXPECT_EQ(nullptr, ipx_ring_pop(ring));
+   ipx_ring_destroy(ring);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   // invoking the tests
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
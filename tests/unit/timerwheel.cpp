@@ -0,0 +1,90 @@
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "../../storage/timerwheel.hpp"
+
+namespace ipxp_test {
+
+using namespace ipxp;
+
+static std::vector<TimerNode *> advance(TimerWheel &wheel, time_t now)
+{
+   std::vector<TimerNode *> expired;
+   TimerNode *node;
+   wheel.advance(now);
+   while ((node = wheel.pop_expired()) != nullptr) {
+      expired.push_back(node);
+   }
+   return expired;
+}
+
+TEST(timerwheel, expire_on_time) {
+   TimerWheel wheel;
+   TimerNode nodes[4];
+   time_t start = 1600000000;
+
+   advance(wheel, start);
+   wheel.schedule(&nodes[0], start + 5);
+   wheel.schedule(&nodes[1], start + 300);
+   wheel.schedule(&nodes[2], start + 20000);
+   wheel.schedule(&nodes[3], start + 3000000);
+   EXPECT_EQ(4U, wheel.size());
+
+   EXPECT_TRUE(advance(wheel, start + 4).empty());
+   EXPECT_EQ(std::vector<TimerNode *>{&nodes[0]}, advance(wheel, start + 5));
+   EXPECT_FALSE(nodes[0].is_scheduled());
+   EXPECT_TRUE(advance(wheel, start + 299).empty());
+   EXPECT_EQ(std::vector<TimerNode *>{&nodes[1]}, advance(wheel, start + 300));
+   EXPECT_TRUE(advance(wheel, start + 19999).empty());
+   EXPECT_EQ(std::vector<TimerNode *>{&nodes[2]}, advance(wheel, start + 20000));
+   EXPECT_TRUE(advance(wheel, start + 2999999).empty());
+   EXPECT_EQ(std::vector<TimerNode *>{&nodes[3]}, advance(wheel, start + 3000000));
+   EXPECT_EQ(0U, wheel.size());
+}
+
+TEST(timerwheel, cancel) {
+   TimerWheel wheel;
+   TimerNode nodes[2];
+
+   advance(wheel, 100);
+   wheel.schedule(&nodes[0], 110);
+   wheel.schedule(&nodes[1], 110);
+   wheel.cancel(&nodes[0]);
+   wheel.cancel(&nodes[0]);
+   EXPECT_FALSE(nodes[0].is_scheduled());
+   EXPECT_EQ(std::vector<TimerNode *>{&nodes[1]}, advance(wheel, 200));
+}
+
+TEST(timerwheel, copy_is_not_scheduled) {
+   TimerWheel wheel;
+   TimerNode node;
+
+   advance(wheel, 100);
+   wheel.schedule(&node, 110);
+   TimerNode copy(node);
+   EXPECT_TRUE(node.is_scheduled());
+   EXPECT_FALSE(copy.is_scheduled());
+}
+
+TEST(timerwheel, out_of_range) {
+   TimerWheel wheel;
+   TimerNode node;
+   time_t far = static_cast<time_t>(1) << 27;
+
+   advance(wheel, 0);
+   wheel.schedule(&node, far);
+   std::vector<TimerNode *> expired = advance(wheel, far - 1);
+   for (auto it : expired) {
+      wheel.schedule(it, it->get_expire());
+   }
+   EXPECT_EQ(std::vector<TimerNode *>{&node}, advance(wheel, far));
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   // invoking the tests
+   ::testing::InitGoogleTest(&argc, argv);
+   return RUN_ALL_TESTS();
+}
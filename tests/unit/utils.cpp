@@ -84,6 +84,17 @@ TEST(str2bool, all) {
    EXPECT_FALSE(str2bool("abc"));
 }
 
+TEST(parse_cpu_list, all) {
+   EXPECT_EQ(std::vector<unsigned>({3}), parse_cpu_list("3"));
+   EXPECT_EQ(std::vector<unsigned>({0, 1, 2, 3, 8, 10, 11}), parse_cpu_list("0-3,8, 10 - 11"));
+   EXPECT_EQ(std::vector<unsigned>({5, 1}), parse_cpu_list("5,1"));
+
+   EXPECT_THROW(parse_cpu_list(""), std::invalid_argument);
+   EXPECT_THROW(parse_cpu_list("1,,2"), std::invalid_argument);
+   EXPECT_THROW(parse_cpu_list("4-2"), std::invalid_argument);
+   EXPECT_THROW(parse_cpu_list("a"), std::invalid_argument);
+}
+
 }
 
 int main(int argc, char **argv)
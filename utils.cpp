@@ -96,6 +96,42 @@ void trim_str(std::string &str)
   }
 }
 
+/**
+ * \brief Parse list of CPUs in format of Linux cpulist, e.g. 0-3,8,10-11.
+ * \param [in] str List to parse.
+ * \return CPUs in order of appearance.
+ */
+std::vector<unsigned> parse_cpu_list(const std::string &str)
+{
+   std::vector<unsigned> cpus;
+   size_t begin = 0;
+   while (begin <= str.size()) {
+      size_t end = str.find(',', begin);
+      if (end == std::string::npos) {
+         end = str.size();
+      }
+      std::string item = str.substr(begin, end - begin);
+      trim_str(item);
+      if (item.find('-') != std::string::npos) {
+         std::string from;
+         std::string to;
+         parse_range(item, from, to);
+         unsigned first = str2num<unsigned>(from);
+         unsigned last = str2num<unsigned>(to);
+         if (first > last) {
+            throw std::invalid_argument(item);
+         }
+         for (unsigned cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+         }
+      } else {
+         cpus.push_back(str2num<unsigned>(item));
+      }
+      begin = end + 1;
+   }
+   return cpus;
+}
+
 void phton64(uint8_t *p, uint64_t v)
 {
    int shift = 56;
@@ -41,8 +41,16 @@
  *
  */
 
+#include <algorithm>
+#include <fstream>
+#include <system_error>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <linux/mempolicy.h>
+
+#include <ipfixprobe/clock.hpp>
 
 #include "workers.hpp"
 #include "ipfixprobe.hpp"
@@ -51,28 +59,135 @@ namespace ipxp {
 
 #define MICRO_SEC 1000000L
 
+CpuBinding::CpuBinding(const std::vector<unsigned> &cpus) : m_bound(false)
+{
+   if (cpus.empty()) {
+      return;
+   }
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   for (auto cpu : cpus) {
+      if (cpu >= CPU_SETSIZE) {
+         throw std::system_error(EINVAL, std::generic_category(), "CPU " + std::to_string(cpu) + " out of range");
+      }
+      CPU_SET(cpu, &set);
+   }
+   if (sched_getaffinity(0, sizeof(m_saved), &m_saved) != 0) {
+      throw std::system_error(errno, std::generic_category(), "unable to get CPU affinity");
+   }
+   if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      throw std::system_error(errno, std::generic_category(), "unable to set CPU affinity");
+   }
+   m_bound = true;
+}
+
+CpuBinding::~CpuBinding()
+{
+   if (m_bound) {
+      sched_setaffinity(0, sizeof(m_saved), &m_saved);
+   }
+}
+
+std::vector<unsigned> get_numa_node_cpus(int node)
+{
+   std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+   std::string list;
+   if (node < 0 || !std::getline(file, list)) {
+      throw std::system_error(ENOENT, std::generic_category(), "NUMA node " + std::to_string(node) + " not found");
+   }
+   try {
+      return parse_cpu_list(list);
+   } catch (std::invalid_argument &e) {
+      throw std::system_error(EINVAL, std::generic_category(), "unable to read CPUs of NUMA node " + std::to_string(node));
+   }
+}
+
+void prefer_numa_node(int node)
+{
+   if (node < 0 || node >= 64) {
+      throw std::system_error(EINVAL, std::generic_category(), "NUMA node " + std::to_string(node) + " out of range");
+   }
+   unsigned long mask = 1UL << node;
+   if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8) != 0) {
+      throw std::system_error(errno, std::generic_category(), "unable to prefer NUMA node " + std::to_string(node));
+   }
+}
+
+IdleBackoff::IdleBackoff(const IdleConfig &config, int fd) :
+   m_busy(0), m_idle(0), m_config(config), m_fd(fd), m_polls(0), m_sleep(1)
+{
+}
+
+void IdleBackoff::idle()
+{
+   m_idle++;
+   if (m_polls < m_config.spin) {
+      m_polls++;
+      return;
+   }
+   if (m_polls - m_config.spin < m_config.yield) {
+      m_polls++;
+      sched_yield();
+      return;
+   }
+   if (m_fd >= 0) {
+      // Arriving work wakes the worker up, timeout only keeps periodic work of the worker running
+      struct pollfd pfd = {m_fd, POLLIN, 0};
+      poll(&pfd, 1, IDLE_BLOCK_TIMEOUT);
+      return;
+   }
+   struct timespec sleep_time = {0, static_cast<long>(m_sleep) * 1000L};
+   nanosleep(&sleep_time, nullptr);
+   m_sleep = std::min(m_sleep * 2, m_config.sleep);
+}
+
+/**
+ * \brief Publish counters of a cache owned by the calling thread, at most once per CACHE_STATS_INTERVAL.
+ * \param [in] cache Storage plugin.
+ * \param [out] out_stats Published counters, nullptr when the cache is not reported.
+ * \param [in] now Current time.
+ * \param [in,out] last Time of the last publication.
+ * \param [in] force Publish regardless of the interval.
+ */
+static void publish_cache_stats(const StoragePlugin *cache, SharedCacheStats *out_stats,
+      const struct timespec &now, struct timespec &last, bool force)
+{
+   if (out_stats == nullptr) {
+      return;
+   }
+   int64_t elapsed = (now.tv_sec - last.tv_sec) * 1000000000L + (now.tv_nsec - last.tv_nsec);
+   if (!force && elapsed < CACHE_STATS_INTERVAL) {
+      return;
+   }
+   CacheStats stats;
+   if (cache->get_stats(stats)) {
+      out_stats->store(stats);
+   }
+   last = now;
+}
+
 void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queue_size, uint64_t pkt_limit,
-                  std::promise<WorkerResult> *out, std::atomic<InputStats> *out_stats)
+                  std::promise<WorkerResult> *out, std::atomic<InputStats> *out_stats, SharedCacheStats *cache_stats,
+                  uint16_t link_index, IdleConfig idle)
 {
    struct timespec start_cache;
    struct timespec end_cache;
    struct timespec begin = {0, 0};
    struct timespec end = {0, 0};
+   struct timespec published = {0, 0};
    struct timeval ts = {0, 0};
    bool timeout = false;
    InputPlugin::Result ret;
-   InputStats stats = {0, 0, 0, 0, 0};
+   InputStats stats = {0, 0, 0, 0, 0, 0, 0};
    WorkerResult res = {false, ""};
+   IdleBackoff backoff(idle, plugin->get_fd());
 
-   PacketBlock block(queue_size);
-
-#ifdef __linux__
-   const clockid_t clk_id = CLOCK_MONOTONIC_COARSE;
-#else
-   const clockid_t clk_id = CLOCK_MONOTONIC;
-#endif
+   PacketBlock own_block(queue_size);
 
    while (!terminate_input) {
+      // Storage of a split pipeline provides its own block, so that packets are not copied one by one
+      PacketBlock *direct = cache->get_block();
+      PacketBlock &block = direct != nullptr ? *direct : own_block;
       block.cnt = 0;
       block.bytes = 0;
 
@@ -90,7 +205,7 @@ void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queu
          break;
       }
       if (ret == InputPlugin::Result::TIMEOUT) {
-         clock_gettime(clk_id, &end);
+         end = CoarseClock::monotonic();
          if (!timeout) {
             timeout = true;
             begin = end;
@@ -100,35 +215,53 @@ void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queu
             diff.tv_nsec += 1000000000;
             diff.tv_sec--;
          }
-         cache->export_expired(ts.tv_sec + diff.tv_sec);
-         usleep(1);
+         try {
+            cache->export_expired(ts.tv_sec + diff.tv_sec);
+         } catch (PluginError &e) {
+            res.error = true;
+            res.msg = e.what();
+            break;
+         }
+         publish_cache_stats(cache, cache_stats, end, published, false);
+         backoff.idle();
+         stats.idle = backoff.m_idle + cache->get_waits();
+         out_stats->store(stats);
          continue;
-      } else if (ret == InputPlugin::Result::PARSED) {
+      }
+      backoff.busy();
+      stats.busy = backoff.m_busy;
+      if (ret == InputPlugin::Result::PARSED) {
          stats.packets = plugin->m_seen;
          stats.parsed = plugin->m_parsed;
          stats.dropped = plugin->m_dropped;
          stats.bytes += block.bytes;
-         clock_gettime(clk_id, &start_cache);
+         for (size_t i = 0; i < block.cnt; i++) {
+            block.pkts[i].link_index = link_index;
+         }
+         // Blocks take microseconds, the coarse clock would round them to zero
+         clock_gettime(CLOCK_MONOTONIC, &start_cache);
+         // Block provided by the storage is not accessible after put
+         ts = block.pkts[block.cnt - 1].ts;
          try {
-            for (unsigned i = 0; i < block.cnt; i++) {
-               cache->put_pkt(block.pkts[i]);
-            }
-            ts = block.pkts[block.cnt - 1].ts;
+            cache->put_pkts(block);
          } catch (PluginError &e) {
             res.error = true;
             res.msg = e.what();
             break;
          }
          timeout = false;
-         clock_gettime(clk_id, &end_cache);
+         clock_gettime(CLOCK_MONOTONIC, &end_cache);
 
          int64_t time = end_cache.tv_nsec - start_cache.tv_nsec;
          if (start_cache.tv_sec != end_cache.tv_sec) {
             time += 1000000000;
          }
          stats.qtime += time;
+         // Waits for a shard which is behind count as idle polls of the input
+         stats.idle = backoff.m_idle + cache->get_waits();
 
          out_stats->store(stats);
+         publish_cache_stats(cache, cache_stats, end_cache, published, false);
       } else if (ret == InputPlugin::Result::ERROR) {
          res.error = true;
          res.msg = "error occured during reading";
@@ -143,6 +276,84 @@ void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queu
    stats.dropped = plugin->m_dropped;
    out_stats->store(stats);
    cache->finish();
+   publish_cache_stats(cache, cache_stats, end, published, true);
+   // Flows with deferred pre_export reach the output queue through the analytics queue
+   auto analyticsq = cache->get_analytics_queue();
+   while (analyticsq != nullptr && ipx_ring_cnt(analyticsq)) {
+      usleep(1);
+   }
+   auto outq = cache->get_queue();
+   while (ipx_ring_cnt(outq)) {
+      usleep(1);
+   }
+   out->set_value(res);
+}
+
+void storage_worker(StoragePlugin *cache, Dispatcher *dispatcher, size_t shard, std::promise<WorkerResult> *out,
+      SharedCacheStats *cache_stats, IdleConfig idle)
+{
+   struct timespec begin = {0, 0};
+   struct timespec end = {0, 0};
+   struct timespec now = {0, 0};
+   struct timespec published = {0, 0};
+   struct timeval ts = {0, 0};
+   bool timeout = false;
+   WorkerResult res = {false, ""};
+   IdleBackoff backoff(idle, -1);
+
+   while (!dispatcher->is_stopped()) {
+      // Inputs are checked before the queues, so that blocks pushed before the last input finished are processed
+      bool last = dispatcher->inputs_done();
+      DispatchBlock *block = dispatcher->pop(shard);
+      if (block == nullptr) {
+         if (last) {
+            break;
+         }
+         end = CoarseClock::monotonic();
+         if (!timeout) {
+            timeout = true;
+            begin = end;
+         }
+         struct timespec diff = {end.tv_sec - begin.tv_sec, end.tv_nsec - begin.tv_nsec};
+         if (diff.tv_nsec < 0) {
+            diff.tv_nsec += 1000000000;
+            diff.tv_sec--;
+         }
+         try {
+            cache->export_expired(ts.tv_sec + diff.tv_sec);
+         } catch (PluginError &e) {
+            res.error = true;
+            res.msg = e.what();
+            break;
+         }
+         publish_cache_stats(cache, cache_stats, end, published, false);
+         backoff.idle();
+         continue;
+      }
+      backoff.busy();
+
+      try {
+         cache->put_pkts(block->m_block);
+         ts = block->m_block.pkts[block->m_block.cnt - 1].ts;
+      } catch (PluginError &e) {
+         res.error = true;
+         res.msg = e.what();
+         dispatcher->release(block);
+         break;
+      }
+      timeout = false;
+      dispatcher->release(block);
+      now = CoarseClock::monotonic();
+      publish_cache_stats(cache, cache_stats, now, published, false);
+   }
+
+   cache->finish();
+   publish_cache_stats(cache, cache_stats, now, published, true);
+   // Flows with deferred pre_export reach the output queue through the analytics queue
+   auto analyticsq = cache->get_analytics_queue();
+   while (analyticsq != nullptr && ipx_ring_cnt(analyticsq)) {
+      usleep(1);
+   }
    auto outq = cache->get_queue();
    while (ipx_ring_cnt(outq)) {
       usleep(1);
@@ -157,57 +368,72 @@ static long timeval_diff(const struct timeval *start, const struct timeval *end)
 }
 
 void output_worker(OutputPlugin *exp, ipx_ring_t *queue, std::promise<WorkerResult> *out, std::atomic<OutputStats> *out_stats,
-   uint32_t fps)
+   uint32_t fps, IdleConfig idle)
 {
    WorkerResult res = {false, ""};
-   OutputStats stats = {0, 0, 0, 0};
+   OutputStats stats = {0, 0, 0, 0, 0, 0};
    struct timespec sleep_time = {0};
    struct timeval begin;
    struct timeval end;
    struct timeval last_flush;
    uint32_t pkts_from_begin = 0;
    double time_per_pkt = 0;
+   Flow *flows[OUTPUT_BURST];
+   uint32_t flow_cnt = 0;
+   uint32_t flow_idx = 0;
 
    if (fps != 0) {
       time_per_pkt = 1000000.0 / fps; // [micro seconds]
    }
 
+   // Queue spins and yields by itself, then blocks until flows arrive
+   ipx_ring_reader_idle(queue, idle.spin, idle.yield);
+
    // Rate limiting algorithm from https://github.com/CESNET/ipfixcol2/blob/master/src/tools/ipfixsend/sender.c#L98
+   // Pacing works with microseconds per flow, so it reads the precise clock
    gettimeofday(&begin, nullptr);
    last_flush = begin;
    while (1) {
-      gettimeofday(&end, nullptr);
-
-      Flow *flow = static_cast<Flow *>(ipx_ring_pop(queue));
-      if (!flow) {
-         if (end.tv_sec - last_flush.tv_sec > 1) {
-            last_flush = end;
-            exp->flush();
-         }
-         if (terminate_export && !ipx_ring_cnt(queue)) {
-            break;
+      if (flow_idx == flow_cnt) {
+         stats.dropped = exp->m_flows_dropped;
+         out_stats->store(stats);
+         flow_idx = 0;
+         flow_cnt = ipx_ring_pop_burst(queue, reinterpret_cast<ipx_msg_t **>(flows), OUTPUT_BURST);
+         if (flow_cnt == 0) {
+            stats.idle++;
+            end = CoarseClock::now();
+            if (end.tv_sec - last_flush.tv_sec > 1) {
+               last_flush = end;
+               exp->flush();
+            }
+            if (terminate_export && !ipx_ring_cnt(queue)) {
+               break;
+            }
+            continue;
          }
-         continue;
+         stats.busy++;
       }
+      Flow *flow = flows[flow_idx++];
 
       stats.biflows++;
       stats.bytes += flow->src_bytes + flow->dst_bytes;
       stats.packets += flow->src_packets + flow->dst_packets;
-      stats.dropped = exp->m_flows_dropped;
-      out_stats->store(stats);
       try {
          exp->export_flow(*flow);
       } catch (PluginError &e) {
          res.error = true;
          res.msg = e.what();
+         flow_idx--;
          break;
       }
+      flow->release();
 
       pkts_from_begin++;
       if (fps == 0) {
          // Limit for packets/s is not enabled
          continue;
       }
+      gettimeofday(&end, nullptr);
 
       // Calculate expected time of sending next packet
       long elapsed = timeval_diff(&begin, &end);
@@ -236,10 +462,50 @@ void output_worker(OutputPlugin *exp, ipx_ring_t *queue, std::promise<WorkerResu
       }
    }
 
+   if (res.error) {
+      // Storages wait for their records, so flows are released without export until termination
+      stats.dropped = exp->m_flows_dropped;
+      out_stats->store(stats);
+      out->set_value(res);
+      while (true) {
+         for (; flow_idx < flow_cnt; flow_idx++) {
+            flows[flow_idx]->release();
+         }
+         flow_idx = 0;
+         flow_cnt = ipx_ring_pop_burst(queue, reinterpret_cast<ipx_msg_t **>(flows), OUTPUT_BURST);
+         if (flow_cnt == 0 && terminate_export && !ipx_ring_cnt(queue)) {
+            break;
+         }
+      }
+      return;
+   }
+
    exp->flush();
    stats.dropped = exp->m_flows_dropped;
    out_stats->store(stats);
    out->set_value(res);
 }
 
+/**
+ * \brief Finish deferred pre_export of flows and hand them to the export queue of their storage.
+ */
+void analytics_worker(ipx_ring_t *queue, IdleConfig idle)
+{
+   Flow *flows[OUTPUT_BURST];
+
+   ipx_ring_reader_idle(queue, idle.spin, idle.yield);
+   while (1) {
+      uint32_t flow_cnt = ipx_ring_pop_burst(queue, reinterpret_cast<ipx_msg_t **>(flows), OUTPUT_BURST);
+      if (flow_cnt == 0) {
+         if (terminate_analytics && !ipx_ring_cnt(queue)) {
+            break;
+         }
+         continue;
+      }
+      for (uint32_t i = 0; i < flow_cnt; i++) {
+         flows[i]->deferred->finish_deferred_export(*flows[i]);
+      }
+   }
+}
+
 }
@@ -46,6 +46,8 @@
 
 #include <future>
 #include <atomic>
+#include <vector>
+#include <sched.h>
 
 #include <ipfixprobe/input.hpp>
 #include <ipfixprobe/storage.hpp>
@@ -55,10 +57,125 @@
 #include <ipfixprobe/ring.h>
 
 #include "stats.hpp"
+#include "dispatcher.hpp"
 
 namespace ipxp {
 
 #define MICRO_SEC 1000000L
+#define CACHE_STATS_INTERVAL 100000000L ///< Nanoseconds between publications of cache counters.
+#define OUTPUT_BURST 64 ///< Flows taken from the output queue at once.
+
+#define IDLE_BLOCK_TIMEOUT 10 ///< Longest block on a descriptor of an idle worker in milliseconds.
+#define IDLE_SPIN 64 ///< Default number of busy polls of an idle worker.
+#define IDLE_YIELD 64 ///< Default number of polls with yielding of an idle worker.
+#define IDLE_SLEEP 100 ///< Default longest sleep of an idle worker in microseconds.
+
+/**
+ * \brief Thresholds of idle workers. A worker without work polls busily, then yields the CPU
+ * between polls, and then blocks until work arrives or sleeps for increasing time.
+ */
+struct IdleConfig {
+   uint32_t spin; /**< Number of busy polls. */
+   uint32_t yield; /**< Number of polls with yielding. */
+   uint32_t sleep; /**< Longest sleep of a worker with no descriptor to block on, in microseconds. */
+
+   IdleConfig() : spin(IDLE_SPIN), yield(IDLE_YIELD), sleep(IDLE_SLEEP)
+   {
+   }
+};
+
+/**
+ * \brief Waiting of a worker polling for work according to IdleConfig.
+ */
+class IdleBackoff {
+public:
+   /**
+    * \param [in] config Thresholds.
+    * \param [in] fd Descriptor which becomes readable when work arrives, -1 if not available.
+    */
+   IdleBackoff(const IdleConfig &config, int fd);
+
+   /**
+    * \brief Called after a poll without work, waits before the next poll.
+    */
+   void idle();
+
+   /**
+    * \brief Called after a poll with work, next idle poll starts spinning again.
+    */
+   void busy()
+   {
+      m_busy++;
+      m_polls = 0;
+      m_sleep = 1;
+   }
+
+   uint64_t m_busy; /**< Polls with work. */
+   uint64_t m_idle; /**< Polls without work. */
+
+private:
+   IdleConfig m_config;
+   int m_fd;
+   uint32_t m_polls;
+   uint32_t m_sleep;
+};
+
+/**
+ * \brief Cache counters published by the thread owning the cache through a seqlock.
+ * CacheStats is too large for a lock-free std::atomic, the writer never waits and readers
+ * retry when they overlap with a store.
+ */
+class SharedCacheStats {
+public:
+   SharedCacheStats() : m_seq(0)
+   {
+      for (auto &it : m_data) {
+         it.store(0, std::memory_order_relaxed);
+      }
+   }
+
+   /**
+    * \brief Publish counters. Must be called from a single thread.
+    */
+   void store(const CacheStats &stats)
+   {
+      const uint64_t *src = reinterpret_cast<const uint64_t *>(&stats);
+      uint32_t seq = m_seq.load(std::memory_order_relaxed);
+      m_seq.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for (size_t i = 0; i < WORDS; i++) {
+         m_data[i].store(src[i], std::memory_order_relaxed);
+      }
+      m_seq.store(seq + 2, std::memory_order_release);
+   }
+
+   /**
+    * \brief Get consistent copy of the last published counters.
+    */
+   CacheStats load() const
+   {
+      CacheStats stats;
+      uint64_t *dst = reinterpret_cast<uint64_t *>(&stats);
+      uint32_t begin;
+      uint32_t end;
+      do {
+         begin = m_seq.load(std::memory_order_acquire);
+         for (size_t i = 0; i < WORDS; i++) {
+            dst[i] = m_data[i].load(std::memory_order_relaxed);
+         }
+         std::atomic_thread_fence(std::memory_order_acquire);
+         end = m_seq.load(std::memory_order_relaxed);
+      } while ((begin & 1) || begin != end);
+      return stats;
+   }
+
+private:
+   static const size_t WORDS = sizeof(CacheStats) / sizeof(uint64_t);
+   static_assert(sizeof(CacheStats) % sizeof(uint64_t) == 0, "CacheStats must consist of 64 bit counters");
+
+   std::atomic<uint32_t> m_seq; /**< Odd while a store is in progress. */
+   std::atomic<uint64_t> m_data[WORDS];
+};
 
 struct WorkerResult {
    bool error;
@@ -75,9 +192,18 @@ struct WorkPipeline {
    struct {
       StoragePlugin *plugin;
       std::vector<ProcessPlugin *> plugins;
+      SharedCacheStats *stats;
    } storage;
 };
 
+struct StorageWorker {
+   StoragePlugin *plugin;
+   std::vector<ProcessPlugin *> plugins;
+   std::thread *thread;
+   std::promise<WorkerResult> *promise;
+   SharedCacheStats *stats;
+};
+
 struct OutputWorker {
    OutputPlugin *plugin;
    std::thread *thread;
@@ -86,10 +212,53 @@ struct OutputWorker {
    ipx_ring_t *queue;
 };
 
+struct AnalyticsWorker {
+   std::thread *thread;
+   ipx_ring_t *queue;
+};
+
+/**
+ * \brief Runs the calling thread on given CPUs until destroyed.
+ *
+ * Threads started meanwhile inherit the CPUs and memory first touched meanwhile is placed
+ * on their NUMA node, so plugins are initialized and their threads started inside the scope.
+ */
+class CpuBinding {
+public:
+   /**
+    * \param [in] cpus CPUs to run on, empty list keeps the current CPUs.
+    * \throw std::system_error when no CPU of the list is usable.
+    */
+   explicit CpuBinding(const std::vector<unsigned> &cpus);
+   ~CpuBinding();
+   CpuBinding(const CpuBinding &other) = delete;
+   CpuBinding &operator=(const CpuBinding &other) = delete;
+
+private:
+   cpu_set_t m_saved;
+   bool m_bound;
+};
+
+/**
+ * \brief Get CPUs of NUMA node.
+ * \throw std::system_error when the node does not exist.
+ */
+std::vector<unsigned> get_numa_node_cpus(int node);
+
+/**
+ * \brief Prefer NUMA node for memory allocated by the calling thread and threads it starts later.
+ * \throw std::system_error on failure.
+ */
+void prefer_numa_node(int node);
+
 void input_storage_worker(InputPlugin *plugin, StoragePlugin *cache, size_t queue_size, uint64_t pkt_limit, 
-      std::promise<WorkerResult> *out, std::atomic<InputStats> *out_stats);
+      std::promise<WorkerResult> *out, std::atomic<InputStats> *out_stats, SharedCacheStats *cache_stats,
+      uint16_t link_index, IdleConfig idle);
+void storage_worker(StoragePlugin *cache, Dispatcher *dispatcher, size_t shard, std::promise<WorkerResult> *out,
+      SharedCacheStats *cache_stats, IdleConfig idle);
 void output_worker(OutputPlugin *exp, ipx_ring_t *queue, std::promise<WorkerResult> *out, std::atomic<OutputStats> *out_stats,
-      uint32_t fps);
+      uint32_t fps, IdleConfig idle);
+void analytics_worker(ipx_ring_t *queue, IdleConfig idle);
 
 }
 